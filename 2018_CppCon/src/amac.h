@@ -0,0 +1,84 @@
+#pragma once
+#include <span>
+#include <stdint.h>
+#include <vector>
+#include <xmmintrin.h>
+
+// Asynchronous memory access chaining (AMAC, Kocberber et al.): a circular
+// buffer of `ring` slots, each holding one lookup and the stage it is at.
+// Every visit runs the slot's current stage, which issues the prefetch the
+// next stage depends on and moves on to the next slot. A slot whose lookup
+// ends starts the next key in the same visit, so a new prefetch is issued
+// for every finished lookup without waiting for the rest of the ring.
+//
+// Stages:
+//   START  take the next key, prefetch the middle of the whole array
+//   PROBE  compare with the prefetched middle, narrow the range and
+//          prefetch its middle, or finish and START again
+//   DONE   no keys left for this slot
+long AmacMultiLookup(
+  std::span<int const> v, std::span<int const> lookups, int ring) {
+  enum Stage : uint8_t { START, PROBE, DONE };
+  struct Slot {
+    int const* first;
+    size_t len;
+    int key;
+    Stage stage = START;
+  };
+  std::vector<Slot> slots(ring);
+  long result = 0;
+
+  if (v.empty())
+    return 0;
+
+  auto beg = v.data();
+  size_t next = 0;
+  int live = ring;
+
+  auto start = [&](Slot& s) {
+    if (next == lookups.size()) {
+      s.stage = DONE;
+      --live;
+      return;
+    }
+    s.key = lookups[next++];
+    s.first = beg;
+    s.len = v.size();
+    s.stage = PROBE;
+    _mm_prefetch(reinterpret_cast<char const*>(beg + s.len / 2), _MM_HINT_NTA);
+  };
+
+  for (int k = 0; live > 0; k = k + 1 == ring ? 0 : k + 1) {
+    auto& s = slots[k];
+    switch (s.stage) {
+    case START:
+      start(s);
+      break;
+    case PROBE: {
+      auto half = s.len / 2;
+      auto x = s.first[half];
+      if (x == s.key) {
+        ++result;
+        start(s);
+        break;
+      }
+      if (x < s.key) {
+        s.first += half + 1;
+        s.len -= half + 1;
+      } else
+        s.len = half;
+      if (s.len == 0) {
+        start(s);
+        break;
+      }
+      _mm_prefetch(reinterpret_cast<char const*>(s.first + s.len / 2),
+                   _MM_HINT_NTA);
+      break;
+    }
+    case DONE:
+      break;
+    }
+  }
+
+  return result;
+}
@@ -1,46 +1,150 @@
 #pragma once
+#include <functional>
+#include <iterator>
+#include <span>
 #include <vector>
-#include <stdio.h>
 
 #include "coro_infra.h"
 
-template <typename Iterator, typename Found, typename NotFound>
-root_task CoroBinarySearch(Iterator first, Iterator last, int val,
-                          Found on_found, NotFound on_not_found) {
-  auto len = last - first;
-  while (len > 0) {
+// A binary search for val between probes. The coroutine searches share it
+// and only differ in what they do around the wait for the probed key.
+template <typename Iterator, typename T, typename Compare>
+struct binary_search_state {
+  Iterator first;
+  typename std::iterator_traits<Iterator>::difference_type len;
+  T val;
+  Compare comp;
+
+  binary_search_state(Iterator first, Iterator last, T val, Compare comp)
+      : first(first), len(last - first), val(val), comp(comp) {}
+
+  bool done() const { return len <= 0; }
+  Iterator middle() const { return first + len / 2; }
+
+  // Narrows the range by x, the key at middle(). True if x is val.
+  bool step(T const &x) {
     auto half = len / 2;
-    auto middle = first + half;
-    auto x = co_await prefetch(*middle);
-    if (x < val) {
-      first = middle;
-      ++first;
+    bool less = comp(x, val);
+    if (less) {
+      first += half + 1;
       len = len - half - 1;
     } else
       len = half;
-    if (x == val)
+    return !less && !comp(val, x);
+  }
+};
+
+// Key is anything Compare orders. After the slot arrives, keys that point at
+// their data (string_view) also wait for the data, see prefetch_payload.
+template <typename Iterator, typename T, typename Found, typename NotFound,
+          typename Compare = std::less<>>
+root_task CoroBinarySearch(Iterator first, Iterator last, T val,
+                          Found on_found, NotFound on_not_found,
+                          Compare comp = {}) {
+  binary_search_state search(first, last, val, comp);
+  while (!search.done()) {
+    auto middle = search.middle();
+    auto x = co_await prefetch(*middle);
+    co_await prefetch_payload(x);
+    if (search.step(x))
       co_return on_found(middle);
   }
   on_not_found();
 }
 
+// Streams is either a fixed count or a stream_tuner for adaptive mode.
+template <typename Key, typename Streams>
 long CoroMultiLookup(
-  std::vector<int> const& v, std::vector<int> const& lookups, int streams) {
+  std::span<Key const> v, std::span<Key const> lookups, Streams&& streams) {
+  return CoroSearchMultiLookup(lookups, streams, [&](Key const &key,
+                                                     auto... cb) {
+    return CoroBinarySearch(v.begin(), v.end(), key, cb...);
+  });
+}
 
-  size_t found_count = 0;
-  size_t not_found_count = 0;
+// Multi lookup over keys arriving in chunks, source.next() returns the next
+// chunk and an empty one at the end. One throttler lives across chunks, so
+// the pipeline never drains between them. Keys are copied into the frames
+// at spawn, the source may reuse a chunk's memory once next() is called.
+template <typename Key, typename Source, typename Streams>
+long CoroStreamMultiLookup(
+  std::span<Key const> v, Source& source, Streams&& streams) {
+  auto search = [&](Key const &key, auto... cb) {
+    return CoroBinarySearch(v.begin(), v.end(), key, cb...);
+  };
+  lookup_counts counts;
+  size_t total = 0;
 
   throttler t(streams);
 
-  for (auto key: lookups)
-    t.spawn(CoroBinarySearch(v.begin(), v.end(), key,
-      [&](auto) { ++found_count; }, [&] { ++not_found_count; }));
+  for (auto chunk = source.next(); !chunk.empty(); chunk = source.next()) {
+    spawn_lookups(t, chunk, search, counts);
+    total += chunk.size();
+  }
 
   t.run();
 
-  if (found_count + not_found_count != lookups.size())
-    printf("BUG: found %zu, not-found: %zu total %zu\n", found_count,
-           not_found_count, found_count + not_found_count);
+  return counts.checked(total);
+}
+
+// Sink that writes the position lookup i was found at to out[i], or -1.
+// The callbacks capture only the output slot.
+template <typename Iterator> struct lookup_positions {
+  std::span<ptrdiff_t> out;
+  Iterator beg;
+
+  auto on_found(size_t i) {
+    return [slot = &out[i], beg = beg](auto it) { *slot = it - beg; };
+  }
+  auto on_not_found(size_t i) {
+    return [slot = &out[i]] { *slot = -1; };
+  }
+};
+
+// Batch multi-get: writes the position of lookups[i] in v, or -1 if it is not
+// there, to out[i]. Nothing is allocated per lookup besides the pooled
+// coroutine frame.
+template <typename Key, typename Streams>
+void CoroMultiGet(std::span<Key const> v, std::span<Key const> lookups,
+                  std::span<ptrdiff_t> out, Streams&& streams) {
+  lookup_positions<typename std::span<Key const>::iterator> sink{out,
+                                                                 v.begin()};
+  CoroSearchAll(lookups, streams, [&](Key const &key, auto... cb) {
+    return CoroBinarySearch(v.begin(), v.end(), key, cb...);
+  }, sink);
+}
+
+// Long-lived lookup coroutine: pulls the next key from the shared cursor and
+// searches for it until the input runs out. Searches like CoroBinarySearch.
+template <typename Key, typename Compare = std::less<>>
+root_task CoroLookupWorker(std::span<Key const> v, std::span<Key const> lookups,
+                           size_t &cursor, long &found_count,
+                           Compare comp = {}) {
+  while (cursor < lookups.size()) {
+    binary_search_state search(v.begin(), v.end(), lookups[cursor++], comp);
+    while (!search.done()) {
+      auto x = co_await prefetch(*search.middle());
+      co_await prefetch_payload(x);
+      if (search.step(x)) {
+        ++found_count;
+        break;
+      }
+    }
+  }
+}
+
+// Multi lookup with exactly `streams` worker coroutines, so the only frames
+// allocated are the workers' at start-up.
+template <typename Key>
+long CoroWorkerMultiLookup(
+  std::span<Key const> v, std::span<Key const> lookups, int streams) {
+  size_t cursor = 0;
+  long found_count = 0;
+
+  throttler t(streams);
+  for (int i = 0; i < streams; ++i)
+    t.spawn(CoroLookupWorker<Key>(v, lookups, cursor, found_count));
+  t.run();
 
   return found_count;
 }
@@ -1,26 +1,76 @@
 #pragma once
 
 #include <xmmintrin.h>
+#include <x86intrin.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <bit>
+#include <deque>
+#include <memory>
+#include <span>
+#include <cstdlib>
+#include <cstdio>
+#include <exception>
+#include <string_view>
 #include <experimental/coroutine>
 
+#include "frame_pool.h"
+#include "latency.h"
+
 ///// --- INFRASTRUCTURE CODE BEGIN ---- ////
 
-struct scheduler_queue {
-  static constexpr const int N = 256;
+// FIFO of ready coroutines. A power of two ring of handles with free-running
+// head/tail counters; when the ring is full further handles spill into a
+// deque and move back into the ring, in order, as it drains. The ring holds
+// N handles in place, or is allocated with room for a larger size asked for
+// at construction.
+template <unsigned N = 256> struct scheduler_queue {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+  static constexpr const unsigned capacity = N; // of the in-place ring
   using coro_handle = std::experimental::coroutine_handle<>;
 
   uint32_t head = 0;
   uint32_t tail = 0;
-  coro_handle arr[N];
+  uint32_t mask = N - 1;
+  coro_handle *arr = ring;
+  std::deque<coro_handle> spill;
+  std::unique_ptr<coro_handle[]> heap;
+  coro_handle ring[N];
+
+  scheduler_queue() = default;
+  scheduler_queue(scheduler_queue const &) = delete;
+
+  // A ring of at least `size` handles, so that many tasks never spill.
+  explicit scheduler_queue(unsigned size) {
+    if (size <= N)
+      return;
+    auto n = std::bit_ceil(size);
+    heap.reset(new coro_handle[n]);
+    arr = heap.get();
+    mask = n - 1;
+  }
+
+  bool full() const { return head - tail == mask + 1; }
+  size_t size() const { return head - tail + spill.size(); }
 
   void push_back(coro_handle h) {
-    arr[head] = h;
-    head = (head + 1) % N;
+    if (full() || !spill.empty()) [[unlikely]] {
+      spill.push_back(h);
+      return;
+    }
+    arr[head++ & mask] = h;
   }
 
   coro_handle pop_front() {
-    auto result = arr[tail];
-    tail = (tail + 1) % N;
+    assert(head != tail && "pop_front on an empty scheduler_queue");
+    auto result = arr[tail++ & mask];
+    if (!spill.empty()) [[unlikely]] {
+      arr[head++ & mask] = spill.front();
+      spill.pop_front();
+    }
+    assert((spill.empty() || full()) &&
+           "scheduler_queue spilled while the ring has room");
     return result;
   }
   auto try_pop_front() { return head != tail ? pop_front() : coro_handle{}; }
@@ -31,8 +81,6 @@ struct scheduler_queue {
   }
 };
 
-inline scheduler_queue scheduler;
-
 // prefetch Awaitable
 template <typename T> struct prefetch_Awaitable {
   T &value;
@@ -44,7 +92,7 @@ template <typename T> struct prefetch_Awaitable {
   template <typename Handle> auto await_suspend(Handle h) {
     _mm_prefetch(reinterpret_cast<char const *>(std::addressof(value)),
                  _MM_HINT_NTA);
-    auto &q = scheduler;
+    auto &q = h.promise().owner->scheduler;
     q.push_back(h);
     return q.pop_front();
   }
@@ -54,53 +102,17 @@ template <typename T> auto prefetch(T &value) {
   return prefetch_Awaitable<T>{value};
 }
 
-// Simple thread caching allocator.
-struct tcalloc {
-  struct header {
-    header *next;
-    size_t size;
-  };
-  header *root = nullptr;
-  size_t last_size_allocated = 0;
-  size_t total = 0;
-  size_t alloc_count = 0;
-
-  ~tcalloc() {
-    auto current = root;
-    while (current) {
-      auto next = current->next;
-      ::free(current);
-      current = next;
-    }
-  }
-
-  void *alloc(size_t sz) {
-    if (root && root->size <= sz) {
-      void *mem = root;
-      root = root->next;
-      return mem;
-    }
-    ++alloc_count;
-    total += sz;
-    last_size_allocated = sz;
-
-    return malloc(sz);
-  }
-
-  void stats() {
-    printf("allocs %zu total %zu sz %zu\n", alloc_count, total, last_size_allocated);
-  }
-
-  void free(void *p, size_t sz) {
-    auto new_entry = static_cast<header *>(p);
-    new_entry->size = sz;
-    new_entry->next = root;
-    root = new_entry;
-  }
-};
-
-inline tcalloc allocator;
+// Second level prefetch for keys that point at their data, the characters of
+// a string_view. Keys compared by value have nothing more to fetch.
+template <typename T>
+std::experimental::suspend_never prefetch_payload(T const &) {
+  return {};
+}
 
+inline auto prefetch_payload(std::string_view s) {
+  static char const empty = 0;
+  return prefetch(*(s.empty() ? &empty : s.data()));
+}
 
 struct throttler;
 
@@ -108,11 +120,9 @@ struct root_task {
   struct promise_type;
   using HDL = std::experimental::coroutine_handle<promise_type>;
 
-  struct promise_type {
+  struct promise_type : frame_pool_allocated {
     throttler *owner = nullptr;
-
-    void *operator new(size_t sz) { return allocator.alloc(sz); }
-    void operator delete(void *p, size_t sz) { allocator.free(p, sz); }
+    uint64_t spawned; // TSC at spawn, set when the owner records latency
 
     root_task get_return_object() { return root_task{*this}; }
     std::experimental::suspend_always initial_suspend() { return {}; }
@@ -143,18 +153,138 @@ private:
   HDL h;
 };
 
-struct throttler {
-  unsigned limit;
+// Child coroutine for a root_task (or another task) to co_await, such as the
+// fetch of the record an index search found. It starts when awaited, runs on
+// its parent's throttler so its prefetches interleave with everyone else's,
+// and hands control back to the parent by symmetric transfer when done.
+template <typename T> struct task {
+  struct promise_type;
+  using HDL = std::experimental::coroutine_handle<promise_type>;
+
+  struct promise_type : frame_pool_allocated {
+    throttler *owner = nullptr;
+    std::experimental::coroutine_handle<> parent;
+    T value{};
+
+    task get_return_object() { return task{*this}; }
+    std::experimental::suspend_always initial_suspend() { return {}; }
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() noexcept { std::terminate(); }
 
-  explicit throttler(unsigned limit) : limit(limit) {}
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      auto await_suspend(HDL h) noexcept { return h.promise().parent; }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+  };
 
-  void on_task_done() { ++limit; }
+  bool await_ready() { return false; }
+  template <typename Promise>
+  HDL await_suspend(std::experimental::coroutine_handle<Promise> parent) {
+    h.promise().owner = parent.promise().owner;
+    h.promise().parent = parent;
+    return h;
+  }
+  T await_resume() { return std::move(h.promise().value); }
+
+  ~task() {
+    if (h)
+      h.destroy();
+  }
+
+  task(task &&rhs) : h(rhs.h) { rhs.h = nullptr; }
+  task(task const &) = delete;
+
+private:
+  task(promise_type &p) : h(HDL::from_promise(p)) {}
+
+  HDL h;
+};
+
+// Hill climbing controller for the number of in-flight coroutines.
+//
+// Every `epoch` completions it measures completed lookups per TSC tick and
+// moves the target by an eighth (at least one) in the current direction,
+// turning around whenever the rate dropped. It keeps what it learned across
+// throttlers, so reuse one tuner per thread across batches.
+struct stream_tuner {
+  unsigned streams = 8;
+  unsigned max_streams = scheduler_queue<>::capacity; // of its ring
+  unsigned epoch = 4096;
+
+  int direction = 1;
+  unsigned done = 0;
+  uint64_t epoch_start = 0;
+  double last_rate = 0;
+
+  uint64_t epochs = 0;
+  uint64_t streams_sum = 0;
+
+  void start() {
+    done = 0;
+    epoch_start = __rdtsc();
+  }
+
+  // Returns the change of the target.
+  int on_task_done() {
+    if (++done < epoch)
+      return 0;
+
+    auto now = __rdtsc();
+    auto rate = double(done) / double(now - epoch_start);
+    done = 0;
+    epoch_start = now;
+
+    if (rate < last_rate)
+      direction = -direction;
+    last_rate = rate;
+
+    int step = std::max(1, int(streams / 8)) * direction;
+    int next = std::clamp(int(streams) + step, 1, int(max_streams));
+    int delta = next - int(streams);
+    streams = next;
+
+    ++epochs;
+    streams_sum += streams;
+    return delta;
+  }
+
+  double mean_streams() const {
+    return epochs ? double(streams_sum) / epochs : streams;
+  }
+};
+
+// Owns the scheduler queue that all of its tasks (and their prefetches) run
+// on, so every thread can drive its own throttler independently.
+struct throttler {
+  scheduler_queue<> scheduler;
+  int limit;
+  stream_tuner *tuner = nullptr;
+  latency_histogram *latency = thread_latency; // spawn to return_void
+
+  // The ring has room for every task, deep stream counts do not spill.
+  explicit throttler(unsigned limit) : scheduler(limit), limit(limit) {}
+
+  // Adaptive mode, the number of tasks in flight follows tuner.streams.
+  explicit throttler(stream_tuner &tuner)
+      : limit(tuner.streams), tuner(&tuner) {
+    tuner.start();
+  }
+
+  void on_task_done() {
+    ++limit;
+    if (tuner)
+      limit += tuner->on_task_done();
+  }
 
   void spawn(root_task t) {
-    if (limit == 0)
+    while (limit <= 0)
       scheduler.pop_front().resume();
 
     auto h = t.set_owner(this);
+    if (latency)
+      h.promise().spawned = __rdtsc();
     scheduler.push_back(h);
     --limit;
   }
@@ -166,6 +296,62 @@ struct throttler {
   ~throttler() { run(); }
 };
 
-void root_task::promise_type::return_void() { owner->on_task_done(); }
+void root_task::promise_type::return_void() {
+  if (owner->latency)
+    owner->latency->record(__rdtsc() - spawned);
+  owner->on_task_done();
+}
+
+// Spawns search(keys[i], on_found, on_not_found) on t for every key, with the
+// callbacks sink.on_found(i) and sink.on_not_found(i) make for that lookup.
+// Every multi lookup spawns through here, so they differ only in the search
+// and in what the callbacks record.
+template <typename Keys, typename Search, typename Sink>
+void spawn_lookups(throttler &t, Keys const &keys, Search &search,
+                   Sink &sink) {
+  for (size_t i = 0; i < keys.size(); ++i)
+    t.spawn(search(keys[i], sink.on_found(i), sink.on_not_found(i)));
+}
+
+// Sink that counts the keys found and not found.
+struct lookup_counts {
+  size_t found = 0;
+  size_t not_found = 0;
+
+  auto on_found(size_t) {
+    return [this](auto &&) { ++found; };
+  }
+  auto on_not_found(size_t) {
+    return [this] { ++not_found; };
+  }
+
+  // The number found, after checking that all `total` lookups finished.
+  long checked(size_t total) const {
+    if (found + not_found != total)
+      printf("BUG: found %zu, not-found: %zu total %zu\n", found, not_found,
+             found + not_found);
+    return found;
+  }
+};
+
+// Runs search for every key of lookups through one throttler, see
+// spawn_lookups.
+template <typename Key, typename Streams, typename Search, typename Sink>
+void CoroSearchAll(std::span<Key const> lookups, Streams &&streams,
+                   Search search, Sink &sink) {
+  throttler t(streams);
+  spawn_lookups(t, lookups, search, sink);
+  t.run();
+}
+
+// Runs `search(key, on_found, on_not_found)` for every key through a throttler
+// and returns the number of keys found.
+template <typename Key, typename Streams, typename Search>
+long CoroSearchMultiLookup(std::span<Key const> lookups, Streams &&streams,
+                           Search search) {
+  lookup_counts counts;
+  CoroSearchAll(lookups, streams, search, counts);
+  return counts.checked(lookups.size());
+}
 
 ///// --- INFRASTRUCTURE CODE END ---- ////
@@ -0,0 +1,234 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+// Thread local coroutine frame pool.
+//
+// Frames are rounded up to a multiple of a cache line and carved out of 64K
+// slabs, one size class per slab, so a request is always served by a block of
+// exactly its class. Every slab remembers the pool that carved it. A frame
+// freed on another thread goes onto the owner's lock-free remote list and is
+// picked up the next time the owner runs out of blocks of that class.
+//
+// Frames larger than max_size come from operator new with a line sized
+// header naming their pool, so they are charged back to it wherever they are
+// freed.
+//
+// Frames must be destroyed before the thread that allocated them exits.
+class frame_pool {
+public:
+  static constexpr size_t line_size = 64;
+  static constexpr size_t slab_size = 64 * 1024;
+  static constexpr size_t class_count = 16;
+  static constexpr size_t max_size = line_size * class_count;
+
+  struct counters {
+    size_t hits;         // served from a free list
+    size_t misses;       // carved from a slab or passed to operator new
+    size_t remote_frees; // frames freed by another thread
+    size_t outstanding;  // bytes currently handed out
+    size_t reserved;     // bytes held in slabs
+
+    void add(counters const &c) {
+      hits += c.hits;
+      misses += c.misses;
+      remote_frees += c.remote_frees;
+      outstanding += c.outstanding;
+      reserved += c.reserved;
+    }
+
+    void print() const {
+      printf("frames: hits %zu misses %zu remote %zu outstanding %zu "
+             "reserved %zu\n",
+             hits, misses, remote_frees, outstanding, reserved);
+    }
+  };
+
+  static frame_pool &local() {
+    static thread_local frame_pool pool;
+    return pool;
+  }
+
+  void *alloc(size_t sz) {
+    if (sz > max_size)
+      return alloc_large(sz);
+    auto c = size_class(sz);
+    allocated += class_bytes(c);
+    if (auto b = free_list[c]) {
+      free_list[c] = b->next;
+      ++hits;
+      return b;
+    }
+    return refill(c);
+  }
+
+  void free(void *p, size_t sz) {
+    if (sz > max_size) {
+      auto base = static_cast<char *>(p) - line_size;
+      auto owner = *reinterpret_cast<frame_pool **>(base);
+      ::operator delete(base, std::align_val_t(line_size));
+      if (owner != this)
+        owner->remote_count_bytes(sz);
+      else
+        freed += sz;
+      return;
+    }
+    auto c = size_class(sz);
+    auto owner = slab_of(p)->owner;
+    if (owner != this)
+      return owner->remote_free(c, p);
+
+    freed += class_bytes(c);
+    auto b = static_cast<block *>(p);
+    b->next = free_list[c];
+    free_list[c] = b;
+  }
+
+  counters stats() const {
+    auto remote = remote_bytes.load(std::memory_order_relaxed);
+    return {hits, misses, remote_count.load(std::memory_order_relaxed),
+            allocated - freed - remote, slab_count * slab_size};
+  }
+
+  // Counters of the calling thread's pool plus those of every pool whose
+  // thread has exited, reserved is summed over the pools.
+  static counters all_stats() {
+    auto result = local().stats();
+    std::lock_guard lock(retired_mutex());
+    result.add(retired());
+    return result;
+  }
+
+  frame_pool() = default;
+  frame_pool(frame_pool const &) = delete;
+
+  ~frame_pool() {
+    {
+      std::lock_guard lock(retired_mutex());
+      retired().add(stats());
+    }
+    // Frames still alive point into our slabs, leak them rather than crash.
+    if (stats().outstanding != 0)
+      return;
+    while (auto s = slabs) {
+      slabs = s->next;
+      std::free(s);
+    }
+  }
+
+private:
+  struct block {
+    block *next;
+  };
+
+  struct slab {
+    slab *next;
+    frame_pool *owner;
+  };
+
+  static counters &retired() {
+    static counters c{};
+    return c;
+  }
+  static std::mutex &retired_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  static size_t size_class(size_t sz) { return sz ? (sz - 1) / line_size : 0; }
+  static size_t class_bytes(size_t c) { return (c + 1) * line_size; }
+
+  static slab *slab_of(void *p) {
+    return reinterpret_cast<slab *>(reinterpret_cast<uintptr_t>(p) &
+                                    ~(slab_size - 1));
+  }
+
+  // Large frames stay in remote_bytes, nothing takes them back.
+  void remote_count_bytes(size_t bytes) {
+    remote_count.fetch_add(1, std::memory_order_relaxed);
+    remote_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void remote_free(size_t c, void *p) {
+    remote_count_bytes(class_bytes(c));
+
+    auto b = static_cast<block *>(p);
+    b->next = remote[c].load(std::memory_order_relaxed);
+    while (!remote[c].compare_exchange_weak(b->next, b,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+      ;
+  }
+
+  __attribute__((noinline)) void *alloc_large(size_t sz) {
+    ++misses;
+    allocated += sz;
+    auto p = static_cast<char *>(
+        ::operator new(sz + line_size, std::align_val_t(line_size)));
+    *reinterpret_cast<frame_pool **>(p) = this;
+    return p + line_size;
+  }
+
+  __attribute__((noinline)) void *refill(size_t c) {
+    // Only the owner ever takes from the remote list and it takes all of it,
+    // so there is no ABA problem here.
+    if (auto b = remote[c].exchange(nullptr, std::memory_order_acquire)) {
+      size_t n = 0;
+      for (auto it = b; it; it = it->next)
+        ++n;
+      remote_bytes.fetch_sub(n * class_bytes(c), std::memory_order_relaxed);
+      freed += n * class_bytes(c);
+      free_list[c] = b->next;
+      ++hits;
+      return b;
+    }
+
+    ++misses;
+    auto sz = class_bytes(c);
+    if (size_t(bump_end[c] - bump[c]) < sz) {
+      void *mem = std::aligned_alloc(slab_size, slab_size);
+      if (!mem)
+        throw std::bad_alloc();
+      auto s = static_cast<slab *>(mem);
+      s->next = slabs;
+      s->owner = this;
+      slabs = s;
+      ++slab_count;
+      bump[c] = static_cast<char *>(mem) + line_size;
+      bump_end[c] = static_cast<char *>(mem) + slab_size;
+    }
+    auto result = bump[c];
+    bump[c] += sz;
+    return result;
+  }
+
+  block *free_list[class_count] = {};
+  char *bump[class_count] = {};
+  char *bump_end[class_count] = {};
+
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t allocated = 0;
+  size_t freed = 0;
+
+  slab *slabs = nullptr;
+  size_t slab_count = 0;
+
+  alignas(line_size) std::atomic<block *> remote[class_count] = {};
+  std::atomic<size_t> remote_count{0};
+  std::atomic<size_t> remote_bytes{0};
+};
+
+// Mix into a promise_type to allocate its coroutine frames from the calling
+// thread's frame_pool.
+struct frame_pool_allocated {
+  static void *operator new(size_t sz) { return frame_pool::local().alloc(sz); }
+  static void operator delete(void *p, size_t sz) {
+    frame_pool::local().free(p, sz);
+  }
+};
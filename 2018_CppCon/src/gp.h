@@ -0,0 +1,62 @@
+#pragma once
+#include <algorithm>
+#include <span>
+#include <vector>
+#include <xmmintrin.h>
+
+// Group prefetching: lookups are taken `group` at a time and advanced level
+// by level in lockstep. Every pass reads the middle element prefetched by the
+// previous pass for each search in the group, then prefetches the next one.
+// The next group starts only when every search of this one is done.
+long GroupPrefetchMultiLookup(
+  std::span<int const> v, std::span<int const> lookups, int group) {
+  struct Search {
+    int const* first;
+    size_t len;
+    int val;
+  };
+  std::vector<Search> g(group);
+  long result = 0;
+
+  auto beg = v.data();
+
+  for (size_t base = 0; base < lookups.size(); base += group) {
+    int count = (int)std::min<size_t>(group, lookups.size() - base);
+    int active = 0;
+    for (int j = 0; j < count; ++j) {
+      g[j] = {beg, v.size(), lookups[base + j]};
+      if (g[j].len > 0) {
+        _mm_prefetch(reinterpret_cast<char const*>(beg + g[j].len / 2),
+                     _MM_HINT_NTA);
+        ++active;
+      }
+    }
+
+    while (active > 0) {
+      for (int j = 0; j < count; ++j) {
+        auto& s = g[j];
+        if (s.len == 0)
+          continue;
+        auto half = s.len / 2;
+        auto middle = s.first + half;
+        auto x = *middle;
+        if (x < s.val) {
+          s.first = middle + 1;
+          s.len = s.len - half - 1;
+        } else
+          s.len = half;
+        if (x == s.val) {
+          ++result;
+          s.len = 0;
+        }
+        if (s.len > 0)
+          _mm_prefetch(reinterpret_cast<char const*>(s.first + s.len / 2),
+                       _MM_HINT_NTA);
+        else
+          --active;
+      }
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+#include <xmmintrin.h>
+
+#include "coro_infra.h"
+
+// Chained hash map from the keys of the sorted array to their position.
+//
+// Nodes live in one array in shuffled order, so walking a chain is a
+// dependent miss per hop, as it is in a hash table built by inserts over
+// time. Bucket count is the next power of two above the key count.
+template <typename Key> struct chained_hash_map {
+  struct node {
+    Key key;
+    uint32_t value;
+    node const *next;
+  };
+
+  std::vector<node const *> buckets;
+  std::vector<node> nodes;
+  unsigned shift;
+
+  explicit chained_hash_map(std::span<Key const> keys) : nodes(keys.size()) {
+    size_t count = 2;
+    shift = 63;
+    while (count < keys.size()) {
+      count *= 2;
+      --shift;
+    }
+    buckets.assign(count, nullptr);
+
+    std::vector<uint32_t> slot(keys.size());
+    for (uint32_t i = 0; i < slot.size(); ++i)
+      slot[i] = i;
+    std::shuffle(slot.begin(), slot.end(), std::mt19937_64(1));
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+      auto &n = nodes[slot[i]];
+      auto &head = buckets[bucket(keys[i])];
+      n.key = keys[i];
+      n.value = (uint32_t)i;
+      n.next = head;
+      head = &n;
+    }
+  }
+
+  // Fibonacci hashing, the top bits of the product pick the bucket.
+  size_t bucket(Key key) const {
+    return (uint64_t(key) * 0x9E3779B97F4A7C15ull) >> shift;
+  }
+};
+
+template <typename Key>
+bool naive_hash_lookup(chained_hash_map<Key> const &m, Key key) {
+  for (auto n = m.buckets[m.bucket(key)]; n; n = n->next)
+    if (n->key == key)
+      return true;
+  return false;
+}
+
+// Handcrafted state machine's frame for a chain walk.
+template <typename Key> struct HashFrame {
+  using node = typename chained_hash_map<Key>::node;
+  enum State { BUCKET, NODE, FOUND, NOT_FOUND, EMPTY };
+
+  node const *const *slot;
+  node const *n;
+  Key key;
+  State state = EMPTY;
+
+  template <typename T> static void prefetch(T const &x) {
+    _mm_prefetch(reinterpret_cast<const char *>(&x), _MM_HINT_NTA);
+  }
+
+  bool busy() const { return state == BUCKET || state == NODE; }
+
+  void init(chained_hash_map<Key> const &m, Key key) {
+    this->key = key;
+    slot = &m.buckets[m.bucket(key)];
+    state = BUCKET;
+    prefetch(*slot);
+  }
+
+  // Consumes the prefetched bucket or node, returns true when done.
+  bool run() {
+    if (state == BUCKET)
+      n = *slot;
+    else if (n->key == key) {
+      state = FOUND;
+      return true;
+    } else
+      n = n->next;
+
+    if (!n) {
+      state = NOT_FOUND;
+      return true;
+    }
+    state = NODE;
+    prefetch(*n);
+    return false;
+  }
+};
+
+// Multi lookup with prefetching using hand-crafted state machine.
+template <typename Key>
+long SmHashMultiLookup(chained_hash_map<Key> const &m,
+                       std::span<Key const> lookups, int streams) {
+  std::vector<HashFrame<Key>> f(streams);
+  size_t i = 0;
+  long result = 0;
+
+  for (auto key : lookups) {
+    for (;;) {
+      auto &fr = f[i];
+      if (++i == f.size())
+        i = 0;
+      if (!fr.busy()) {
+        fr.init(m, key);
+        break;
+      }
+      if (fr.run()) {
+        if (fr.state == HashFrame<Key>::FOUND)
+          ++result;
+        fr.init(m, key);
+        break;
+      }
+    }
+  }
+
+  bool moreWork = false;
+  do {
+    moreWork = false;
+    for (auto &fr : f)
+      if (fr.busy()) {
+        moreWork = true;
+        if (fr.run() && fr.state == HashFrame<Key>::FOUND)
+          ++result;
+      }
+  } while (moreWork);
+
+  return result;
+}
+
+template <typename Key, typename Found, typename NotFound>
+root_task CoroHashLookup(chained_hash_map<Key> const &m, Key key,
+                         Found on_found, NotFound on_not_found) {
+  auto n = co_await prefetch(m.buckets[m.bucket(key)]);
+  while (n) {
+    auto &node = co_await prefetch(*n);
+    if (node.key == key)
+      co_return on_found(node);
+    n = node.next;
+  }
+  on_not_found();
+}
+
+template <typename Key, typename Streams>
+long CoroHashMultiLookup(chained_hash_map<Key> const &m,
+                         std::span<Key const> lookups, Streams &&streams) {
+  return CoroSearchMultiLookup(lookups, streams, [&](Key key, auto... cb) {
+    return CoroHashLookup(m, key, cb...);
+  });
+}
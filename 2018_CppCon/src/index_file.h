@@ -0,0 +1,227 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "key_type.h"
+#include "rng.h"
+
+// On-disk sorted index. A header page is followed by `count` keys in
+// ascending order, native byte order, so a read-only mapping of the file is
+// an array the search engines run over without a rebuild:
+//
+//   0     index_header, rest of the page zero
+//   4096  Key keys[count]
+//
+// The checksum is FNV-1a over the keys as 64 bit words (the last word zero
+// padded), with the SplitMix64 finaliser after every word so that the high
+// bits of a word reach the low bits of the checksum too. Version 1 files
+// used plain FNV-1a. Opening a file checks the header only, so a cold open
+// touches no key pages; verify() reads them all.
+
+enum class index_layout : uint32_t { sorted = 0 };
+
+struct index_header {
+  static constexpr char expected_magic[8] = {'N', 'T', 'I', 'N',
+                                             'D', 'E', 'X', '\0'};
+  static constexpr uint32_t current_version = 2;
+  static constexpr size_t keys_offset = 4096;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t key;      // key_type
+  uint32_t key_size; // sizeof(Key), catches key_type renumbering
+  uint32_t layout;   // index_layout
+  uint64_t count;
+  uint64_t checksum;
+};
+
+struct index_checksum {
+  uint64_t h = 0xcbf29ce484222325ull;
+  uint64_t word = 0;
+  size_t bytes = 0;
+
+  void add(void const *p, size_t n) {
+    auto c = static_cast<unsigned char const *>(p);
+    // Whole words at a time when aligned, a byte loop is too slow for 16G.
+    while (n && bytes % 8) {
+      word |= uint64_t(*c++) << (8 * (bytes++ % 8));
+      --n;
+      if (bytes % 8 == 0)
+        mix();
+    }
+    for (; n >= 8; n -= 8, c += 8, bytes += 8) {
+      memcpy(&word, c, 8);
+      mix();
+    }
+    while (n--)
+      word |= uint64_t(*c++) << (8 * (bytes++ % 8));
+  }
+
+  uint64_t value() {
+    if (bytes % 8)
+      mix();
+    bytes = 0;
+    return h;
+  }
+
+private:
+  void mix() {
+    h = splitmix64_mix((h ^ word) * 0x100000001b3ull);
+    word = 0;
+  }
+};
+
+// Writes the index of the even numbers 0, 2, .. 2 * (count - 1) as Key, the
+// array nanotest generates, streaming it out a chunk at a time.
+template <typename Key>
+bool write_index(std::string_view path, uint64_t count) {
+  auto name = std::string(path);
+  auto f = fopen(name.c_str(), "wb");
+  if (!f) {
+    fprintf(stderr, "index: cannot create %s (%s)\n", name.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  index_header h = {};
+  memcpy(h.magic, index_header::expected_magic, sizeof(h.magic));
+  h.version = index_header::current_version;
+  h.key = (uint32_t)key_type_of<Key>();
+  h.key_size = sizeof(Key);
+  h.layout = (uint32_t)index_layout::sorted;
+  h.count = count;
+
+  std::vector<char> page(index_header::keys_offset);
+  bool ok = fwrite(page.data(), page.size(), 1, f) == 1;
+
+  index_checksum sum;
+  std::vector<Key> chunk(64 * 1024);
+  for (uint64_t i = 0; ok && i < count;) {
+    size_t n = 0;
+    for (; n < chunk.size() && i < count; ++n, ++i)
+      chunk[n] = Key(i) + Key(i);
+    sum.add(chunk.data(), n * sizeof(Key));
+    ok = fwrite(chunk.data(), sizeof(Key), n, f) == n;
+  }
+  h.checksum = sum.value();
+
+  memcpy(page.data(), &h, sizeof(h));
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 &&
+       fwrite(page.data(), page.size(), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+    fprintf(stderr, "index: writing %s failed (%s)\n", name.c_str(),
+            strerror(errno));
+  return ok;
+}
+
+// Read-only mapping of an index file.
+class index_file {
+  int fd = -1;
+  char const *map = nullptr;
+  size_t bytes = 0;
+
+  bool fail(char const *what, bool use_errno = true) {
+    if (use_errno)
+      fprintf(stderr, "index: %s %s failed (%s)\n", what, name.c_str(),
+              strerror(errno));
+    else
+      fprintf(stderr, "index: %s: %s\n", name.c_str(), what);
+    close();
+    return false;
+  }
+
+  void close() {
+    if (map)
+      munmap(const_cast<char *>(map), bytes);
+    if (fd >= 0)
+      ::close(fd);
+    map = nullptr;
+    fd = -1;
+  }
+
+public:
+  std::string name;
+
+  explicit index_file(std::string_view path) : name(path) { open(); }
+  ~index_file() { close(); }
+  index_file(index_file const &) = delete;
+
+  bool open() {
+    fd = ::open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+      return fail("open");
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+      return fail("stat");
+    bytes = st.st_size;
+    if (bytes < index_header::keys_offset)
+      return fail("too short for an index", false);
+    auto p = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      return fail("mmap");
+    map = static_cast<char const *>(p);
+
+    auto &h = header();
+    key_type key = static_cast<key_type>(h.key);
+    if (memcmp(h.magic, index_header::expected_magic, sizeof(h.magic)) != 0)
+      return fail("not an index", false);
+    if (h.version != index_header::current_version)
+      return fail("unsupported version", false);
+    if (key_type_size(key) == 0 || key_type_size(key) != h.key_size)
+      return fail("unknown key type", false);
+    if (h.layout != (uint32_t)index_layout::sorted)
+      return fail("unknown layout", false);
+    if ((bytes - index_header::keys_offset) / h.key_size < h.count)
+      return fail("truncated", false);
+    return true;
+  }
+
+  bool ok() const { return map != nullptr; }
+
+  index_header const &header() const {
+    return *reinterpret_cast<index_header const *>(map);
+  }
+
+  key_type key() const { return static_cast<key_type>(header().key); }
+
+  template <typename Key> std::span<Key const> keys() const {
+    if (key() != key_type_of<Key>())
+      return {};
+    return {reinterpret_cast<Key const *>(map + index_header::keys_offset),
+            header().count};
+  }
+
+  // Reads every key and compares the checksum with the header's.
+  bool verify() const {
+    index_checksum sum;
+    sum.add(map + index_header::keys_offset,
+            header().count * header().key_size);
+    return sum.value() == header().checksum;
+  }
+
+  // Evicts the keys from the page cache, so the next run starts cold. Only
+  // clean pages no other process has mapped can go.
+  void drop_cache() const {
+    madvise(const_cast<char *>(map), bytes, MADV_DONTNEED);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+
+  void print() const {
+    auto &h = header();
+    printf("index %s: %llu %s keys, %s layout, checksum %016llx\n",
+           name.c_str(), (unsigned long long)h.count, key_type_name(key()),
+           "sorted", (unsigned long long)h.checksum);
+  }
+};
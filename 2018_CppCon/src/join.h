@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <xmmintrin.h>
+
+#include "coro_infra.h"
+#include "hash.h"
+
+// Hash join probe. The build relation is a chained_hash_map, every node's
+// value is the build tuple id. Each probe key emits one output tuple per
+// matching node, so whole chains are walked even after a match. Output goes
+// to a caller-provided vector, reserve it to keep allocation out of the loop.
+
+struct join_tuple {
+  uint32_t build;
+  uint32_t probe;
+};
+
+template <typename Key>
+size_t NaiveHashJoin(chained_hash_map<Key> const &m, std::span<Key const> probe,
+                     uint32_t rid, std::vector<join_tuple> &out) {
+  auto before = out.size();
+  for (auto key : probe) {
+    for (auto n = m.buckets[m.bucket(key)]; n; n = n->next)
+      if (n->key == key)
+        out.push_back({n->value, rid});
+    ++rid;
+  }
+  return out.size() - before;
+}
+
+// Handcrafted state machine's frame for a probe.
+template <typename Key> struct JoinFrame {
+  using node = typename chained_hash_map<Key>::node;
+  enum State { BUCKET, NODE, EMPTY };
+
+  node const *const *slot;
+  node const *n;
+  Key key;
+  uint32_t rid;
+  State state = EMPTY;
+
+  void init(chained_hash_map<Key> const &m, Key key, uint32_t rid) {
+    this->key = key;
+    this->rid = rid;
+    slot = &m.buckets[m.bucket(key)];
+    state = BUCKET;
+    _mm_prefetch(reinterpret_cast<char const *>(slot), _MM_HINT_NTA);
+  }
+
+  // Consumes the prefetched bucket or node, returns true when done.
+  bool run(std::vector<join_tuple> &out) {
+    if (state == BUCKET)
+      n = *slot;
+    else {
+      if (n->key == key)
+        out.push_back({n->value, rid});
+      n = n->next;
+    }
+
+    if (!n) {
+      state = EMPTY;
+      return true;
+    }
+    state = NODE;
+    _mm_prefetch(reinterpret_cast<char const *>(n), _MM_HINT_NTA);
+    return false;
+  }
+};
+
+template <typename Key>
+size_t SmHashJoin(chained_hash_map<Key> const &m, std::span<Key const> probe,
+                  uint32_t rid, std::vector<join_tuple> &out, int streams) {
+  auto before = out.size();
+  std::vector<JoinFrame<Key>> f(streams);
+  size_t i = 0;
+
+  for (auto key : probe) {
+    for (;;) {
+      auto &fr = f[i];
+      if (++i == f.size())
+        i = 0;
+      if (fr.state == JoinFrame<Key>::EMPTY || fr.run(out)) {
+        fr.init(m, key, rid++);
+        break;
+      }
+    }
+  }
+
+  bool moreWork = false;
+  do {
+    moreWork = false;
+    for (auto &fr : f)
+      if (fr.state != JoinFrame<Key>::EMPTY) {
+        moreWork = true;
+        fr.run(out);
+      }
+  } while (moreWork);
+
+  return out.size() - before;
+}
+
+template <typename Key>
+root_task CoroJoinProbe(chained_hash_map<Key> const &m, Key key, uint32_t rid,
+                        std::vector<join_tuple> &out) {
+  auto n = co_await prefetch(m.buckets[m.bucket(key)]);
+  while (n) {
+    auto &node = co_await prefetch(*n);
+    if (node.key == key)
+      out.push_back({node.value, rid});
+    n = node.next;
+  }
+}
+
+template <typename Key, typename Streams>
+size_t CoroHashJoin(chained_hash_map<Key> const &m, std::span<Key const> probe,
+                    uint32_t rid, std::vector<join_tuple> &out,
+                    Streams &&streams) {
+  auto before = out.size();
+
+  throttler t(streams);
+  for (auto key : probe)
+    t.spawn(CoroJoinProbe(m, key, rid++, out));
+  t.run();
+
+  return out.size() - before;
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lookup keys read as native 32 bit ints from a file, or from stdin for "-",
+// `chunk` keys at a time. A chunk is valid until the next call to next(), so
+// memory use stays the same however long the input is: a file is mapped
+// read-only and the pages already consumed are dropped, stdin is read into
+// one chunk sized buffer.
+class key_stream {
+  int fd = -1;
+  char const *map = nullptr;
+  size_t map_bytes = 0;
+  size_t pos = 0;     // bytes of the mapping consumed
+  size_t dropped = 0; // bytes of the mapping given back
+
+  std::vector<int> buf;
+  size_t tail = 0; // bytes of a partial key left after the last chunk
+  size_t last = 0; // where in buf that partial key starts
+
+  size_t chunk;
+  size_t consumed = 0;
+
+public:
+  // Called with every chunk next() returns, before the caller sees it.
+  std::function<void(std::span<int const>)> observer;
+
+private:
+  static void error(std::string_view path, char const *what) {
+    fprintf(stderr, "keys: %s %.*s failed (%s)\n", what, (int)path.size(),
+            path.data(), strerror(errno));
+  }
+
+public:
+  explicit key_stream(std::string_view path, size_t chunk = 64 * 1024)
+      : chunk(chunk) {
+    if (path == "-") {
+      fd = STDIN_FILENO;
+      buf.resize(chunk);
+      return;
+    }
+
+    fd = open(std::string(path).c_str(), O_RDONLY);
+    if (fd < 0) {
+      error(path, "open");
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      error(path, "stat");
+      close(fd);
+      fd = -1;
+      return;
+    }
+    map_bytes = st.st_size;
+    if (map_bytes == 0)
+      return;
+    auto p = mmap(nullptr, map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      error(path, "mmap");
+      close(fd);
+      fd = -1;
+      return;
+    }
+    map = static_cast<char const *>(p);
+    madvise(p, map_bytes, MADV_SEQUENTIAL);
+  }
+
+  ~key_stream() {
+    if (map)
+      munmap(const_cast<char *>(map), map_bytes);
+    if (fd > STDIN_FILENO)
+      close(fd);
+  }
+
+  key_stream(key_stream const &) = delete;
+
+  bool ok() const { return fd >= 0; }
+
+  // Number of keys returned so far.
+  size_t count() const { return consumed; }
+
+  // Next chunk of keys, empty at the end of the input. A trailing partial
+  // key is ignored.
+  std::span<int const> next() {
+    auto keys = fd == STDIN_FILENO ? read_chunk() : map_chunk();
+    consumed += keys.size();
+    if (observer && !keys.empty())
+      observer(keys);
+    return keys;
+  }
+
+private:
+  std::span<int const> map_chunk() {
+    // Give back the pages of the previous chunk, they are not needed again.
+    auto page = (size_t)sysconf(_SC_PAGESIZE);
+    auto done = pos & ~(page - 1);
+    if (done > dropped) {
+      madvise(const_cast<char *>(map) + dropped, done - dropped,
+              MADV_DONTNEED);
+      dropped = done;
+    }
+
+    auto n = std::min(chunk, (map_bytes - pos) / sizeof(int));
+    auto keys = reinterpret_cast<int const *>(map + pos);
+    pos += n * sizeof(int);
+    return {keys, n};
+  }
+
+  std::span<int const> read_chunk() {
+    auto bytes = reinterpret_cast<char *>(buf.data());
+    auto want = buf.size() * sizeof(int);
+    // The partial key read last time goes in front of this chunk.
+    auto have = tail;
+    if (tail)
+      memmove(bytes, bytes + last, tail);
+    while (have < want) {
+      auto got = read(fd, bytes + have, want - have);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got < 0)
+        error("stdin", "read");
+      if (got <= 0)
+        break;
+      have += got;
+    }
+    auto n = have / sizeof(int);
+    tail = have % sizeof(int);
+    last = n * sizeof(int);
+    return {buf.data(), n};
+  }
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Type of the array's keys. i32 runs every algorithm, the others run the
+// generic naive, sm and coro searches.
+enum class key_type { i32, u32, u64, u128 };
+
+inline char const *key_type_name(key_type type) {
+  switch (type) {
+  case key_type::i32: return "i32";
+  case key_type::u32: return "u32";
+  case key_type::u64: return "u64";
+  case key_type::u128: return "u128";
+  }
+  return "?";
+}
+
+inline bool parse_key_type(std::string_view name, key_type &type) {
+  for (auto t : {key_type::i32, key_type::u32, key_type::u64, key_type::u128})
+    if (name == key_type_name(t)) {
+      type = t;
+      return true;
+    }
+  return false;
+}
+
+inline size_t key_type_size(key_type type) {
+  switch (type) {
+  case key_type::i32:
+  case key_type::u32: return 4;
+  case key_type::u64: return 8;
+  case key_type::u128: return 16;
+  }
+  return 0;
+}
+
+template <typename Key> constexpr key_type key_type_of();
+template <> constexpr key_type key_type_of<int>() { return key_type::i32; }
+template <> constexpr key_type key_type_of<uint32_t>() { return key_type::u32; }
+template <> constexpr key_type key_type_of<uint64_t>() { return key_type::u64; }
+template <> constexpr key_type key_type_of<unsigned __int128>() {
+  return key_type::u128;
+}
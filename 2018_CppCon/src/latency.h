@@ -0,0 +1,88 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <x86intrin.h>
+
+// Log-linear histogram of cycle counts. Values below 16 get a bucket each,
+// above that every power of two is split into 16 buckets, so a bucket is at
+// most 1/16 of its values wide. Recording is a clz, a shift and an add.
+struct latency_histogram {
+  static constexpr int sub_bits = 4;
+  static constexpr int sub = 1 << sub_bits;
+  static constexpr int buckets = (64 - sub_bits + 1) * sub;
+
+  uint64_t counts[buckets] = {};
+  uint64_t total = 0;
+
+  static int bucket(uint64_t v) {
+    if (v < sub)
+      return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - sub_bits + 1) * sub + int((v >> (e - sub_bits)) & (sub - 1));
+  }
+
+  // Smallest value that lands in bucket b.
+  static uint64_t lower(int b) {
+    if (b < sub)
+      return b;
+    int e = b / sub + sub_bits - 1;
+    return (uint64_t(1) << e) | (uint64_t(b % sub) << (e - sub_bits));
+  }
+
+  void record(uint64_t cycles) {
+    ++counts[bucket(cycles)];
+    ++total;
+  }
+
+  void merge(latency_histogram const &rhs) {
+    for (int b = 0; b < buckets; ++b)
+      counts[b] += rhs.counts[b];
+    total += rhs.total;
+  }
+
+  // Value at quantile q (0.5 for the median), the middle of its bucket.
+  double quantile(double q) const {
+    if (total == 0)
+      return 0;
+    auto rank = uint64_t(q * (total - 1));
+    uint64_t seen = 0;
+    for (int b = 0; b < buckets; ++b) {
+      seen += counts[b];
+      if (seen > rank)
+        return b + 1 < buckets ? (lower(b) + lower(b + 1) - 1) / 2.0
+                               : (double)lower(b);
+    }
+    return (double)lower(buckets - 1);
+  }
+};
+
+// TSC ticks per ns, measured once against the steady clock.
+inline double tsc_per_ns() {
+  static double rate = [] {
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    auto c0 = __rdtsc();
+    while (clock::now() - t0 < std::chrono::milliseconds(20))
+      ;
+    auto c1 = __rdtsc();
+    std::chrono::duration<double, std::nano> ns = clock::now() - t0;
+    return (c1 - c0) / ns.count();
+  }();
+  return rate;
+}
+
+// Histogram that throttlers created on this thread record into, null when
+// latency is not measured.
+inline thread_local latency_histogram *thread_latency = nullptr;
+
+// Makes throttlers created on this thread record into h while it lives.
+struct latency_scope {
+  latency_histogram *saved;
+
+  explicit latency_scope(latency_histogram *h) : saved(thread_latency) {
+    thread_latency = h;
+  }
+  ~latency_scope() { thread_latency = saved; }
+  latency_scope(latency_scope const &) = delete;
+};
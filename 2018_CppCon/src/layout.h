@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+#include <xmmintrin.h>
+
+#include "coro_infra.h"
+#include "pages.h"
+
+// Sorted keys rearranged for search.
+//
+// eytzinger: the implicit binary search tree in breadth-first order, node k
+// has children 2k and 2k+1 (1-based). The array is line aligned, so the top
+// levels share cache lines and the 64 / sizeof(Key) descendants of node k
+// that many times down, t[k * 64 / sizeof(Key)] on, fill exactly one line
+// (the 16 great-great-grandchildren for int keys).
+//
+// stree: an implicit static B-tree with one node per cache line (B = 16 int
+// keys). Node k has children k*(B+1)+1 .. k*(B+1)+B+1. Unused slots at the end
+// are padded with the largest key.
+
+template <typename Key> struct eytzinger {
+  std::vector<Key, page_allocator<Key>> t; // t[0] is unused
+  size_t n;
+
+  explicit eytzinger(std::span<Key const> keys)
+      : t(keys.size() + 1), n(keys.size()) {
+    static_assert(64 % sizeof(Key) == 0, "keys must tile a cache line");
+    assert(reinterpret_cast<uintptr_t>(t.data()) % 64 == 0 &&
+           "eytzinger array is not line aligned");
+    size_t i = 0;
+    build(keys, i, 1);
+  }
+
+  void build(std::span<Key const> keys, size_t &i, size_t k) {
+    if (k > n)
+      return;
+    build(keys, i, 2 * k);
+    t[k] = keys[i++];
+    build(keys, i, 2 * k + 1);
+  }
+
+  bool naive_search(Key x) const {
+    size_t k = 1;
+    while (k <= n) {
+      if (t[k] == x)
+        return true;
+      k = 2 * k + (t[k] < x);
+    }
+    return false;
+  }
+
+  // Descends to a leaf without branching on the comparison. The trailing one
+  // bits of k are the right turns after the lower bound, dropping them
+  // recovers the lower bound (0 if x is greater than every key).
+  bool branchless_search(Key x) const {
+    size_t k = 1;
+    while (k <= n)
+      k = 2 * k + (t[k] < x);
+    k >>= __builtin_ffsll(~k);
+    return k != 0 && t[k] == x;
+  }
+
+  // As branchless_search, also prefetching the line holding the node's
+  // descendants log2(64 / sizeof(Key)) levels down.
+  bool prefetch_search(Key x) const {
+    constexpr size_t ahead = 64 / sizeof(Key);
+    size_t k = 1;
+    while (k <= n) {
+      _mm_prefetch(reinterpret_cast<char const *>(t.data()) +
+                       k * ahead * sizeof(Key),
+                   _MM_HINT_T0);
+      k = 2 * k + (t[k] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k != 0 && t[k] == x;
+  }
+};
+
+template <typename Key> struct stree {
+  static constexpr int B = 64 / sizeof(Key);
+
+  struct alignas(64) node {
+    Key keys[B];
+
+    // Number of keys less than x, compiles into vector compares.
+    int rank(Key x) const {
+      int r = 0;
+      for (int i = 0; i < B; ++i)
+        r += keys[i] < x;
+      return r;
+    }
+  };
+
+  std::vector<node> nodes;
+
+  static size_t child(size_t k, int i) { return k * (B + 1) + i + 1; }
+
+  explicit stree(std::span<Key const> keys)
+      : nodes((keys.size() + B - 1) / B) {
+    size_t i = 0;
+    build(keys, i, 0);
+  }
+
+  void build(std::span<Key const> keys, size_t &i, size_t k) {
+    if (k >= nodes.size())
+      return;
+    for (int j = 0; j < B; ++j) {
+      build(keys, i, child(k, j));
+      nodes[k].keys[j] =
+          i < keys.size() ? keys[i++] : std::numeric_limits<Key>::max();
+    }
+    build(keys, i, child(k, B));
+  }
+
+  bool naive_search(Key x) const {
+    size_t k = 0;
+    while (k < nodes.size()) {
+      auto &nd = nodes[k];
+      int i = 0;
+      while (i < B && nd.keys[i] < x)
+        ++i;
+      if (i < B && nd.keys[i] == x)
+        return true;
+      k = child(k, i);
+    }
+    return false;
+  }
+
+  bool branchless_search(Key x) const {
+    size_t k = 0;
+    while (k < nodes.size()) {
+      auto &nd = nodes[k];
+      int i = nd.rank(x);
+      if (i < B && nd.keys[i] == x)
+        return true;
+      k = child(k, i);
+    }
+    return false;
+  }
+
+  // Descends groups of `group` searches level by level, prefetching every
+  // search's next node before any of them is visited. Returns number found.
+  long prefetch_search(std::span<Key const> batch, int group) const {
+    std::vector<size_t> k(group);
+    long found = 0;
+
+    for (size_t first = 0; first < batch.size(); first += group) {
+      int count = (int)std::min<size_t>(group, batch.size() - first);
+      for (int j = 0; j < count; ++j)
+        k[j] = 0;
+
+      for (int active = count; active > 0;) {
+        active = 0;
+        for (int j = 0; j < count; ++j) {
+          if (k[j] >= nodes.size())
+            continue;
+          auto x = batch[first + j];
+          auto &nd = nodes[k[j]];
+          int i = nd.rank(x);
+          if (i < B && nd.keys[i] == x) {
+            ++found;
+            k[j] = nodes.size();
+            continue;
+          }
+          k[j] = child(k[j], i);
+          if (k[j] < nodes.size()) {
+            _mm_prefetch(reinterpret_cast<char const *>(&nodes[k[j]]),
+                         _MM_HINT_T0);
+            ++active;
+          }
+        }
+      }
+    }
+    return found;
+  }
+};
+
+template <typename Key, typename Found, typename NotFound>
+root_task CoroEytzingerSearch(eytzinger<Key> const &e, Key x, Found on_found,
+                              NotFound on_not_found) {
+  size_t k = 1;
+  while (k <= e.n) {
+    auto y = co_await prefetch(e.t[k]);
+    if (y == x)
+      co_return on_found(k);
+    k = 2 * k + (y < x);
+  }
+  on_not_found();
+}
+
+template <typename Key, typename Found, typename NotFound>
+root_task CoroSTreeSearch(stree<Key> const &s, Key x, Found on_found,
+                          NotFound on_not_found) {
+  size_t k = 0;
+  while (k < s.nodes.size()) {
+    auto &nd = co_await prefetch(s.nodes[k]);
+    int i = nd.rank(x);
+    if (i < stree<Key>::B && nd.keys[i] == x)
+      co_return on_found(k);
+    k = s.child(k, i);
+  }
+  on_not_found();
+}
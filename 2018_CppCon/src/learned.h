@@ -0,0 +1,201 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "coro_infra.h"
+
+// Searches that predict a key's position from its value, then finish with a
+// binary search of a bounded range (the last mile).
+//
+// interpolation: up to interp_steps probes at the position linear
+// interpolation between the ends of the current range predicts, then a
+// binary search once the range is at most interp_last_mile keys.
+//
+// rmi: a two-stage learned index. A linear root model picks one of the leaf
+// models, a leaf is a least squares line from key to position plus the
+// smallest and largest error of the keys it covers, so a key that is
+// present is always inside the leaf's range.
+
+constexpr int interp_steps = 8;
+constexpr size_t interp_last_mile = 64;
+
+// Position of x between a and b in [lo, hi), interpolated.
+template <typename Key>
+size_t interpolate(Key x, Key a, Key b, size_t lo, size_t hi) {
+  if (a == b)
+    return lo;
+  return lo + size_t(double(x - a) / double(b - a) * double(hi - 1 - lo));
+}
+
+template <typename Key>
+bool range_search(std::span<Key const> v, size_t lo, size_t hi, Key x) {
+  while (lo < hi) {
+    auto mid = lo + (hi - lo) / 2;
+    auto y = v[mid];
+    if (y == x)
+      return true;
+    if (y < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return false;
+}
+
+template <typename Key>
+bool interpolation_search(std::span<Key const> v, Key x) {
+  size_t lo = 0, hi = v.size();
+  for (int steps = interp_steps; hi - lo > interp_last_mile && steps > 0;
+       --steps) {
+    Key a = v[lo], b = v[hi - 1];
+    if (x < a || b < x)
+      return false;
+    auto pos = interpolate(x, a, b, lo, hi);
+    auto y = v[pos];
+    if (y == x)
+      return true;
+    if (y < x)
+      lo = pos + 1;
+    else
+      hi = pos;
+  }
+  return range_search(v, lo, hi, x);
+}
+
+template <typename Key> struct rmi {
+  struct leaf {
+    double slope;
+    double intercept;
+    int32_t err_lo; // smallest position - prediction of the leaf's keys
+    int32_t err_hi; // largest
+  };
+
+  double root_slope;
+  Key first;
+  size_t n;
+  std::vector<leaf> leaves;
+  double mean_range = 0; // last-mile keys per present key
+
+  explicit rmi(std::span<Key const> v, size_t leaf_keys = 1024)
+      : first(v.empty() ? Key() : v.front()), n(v.size()),
+        leaves(std::max<size_t>(1, v.size() / leaf_keys)) {
+    root_slope = v.empty() ? 0
+                           : double(leaves.size()) /
+                                 (double(v.back() - first) + 1);
+
+    // The root is monotone, so every leaf covers a contiguous run of keys.
+    size_t b = 0;
+    for (size_t j = 0; j < leaves.size(); ++j) {
+      size_t e = b;
+      while (e < n && leaf_of(v[e]) == j)
+        ++e;
+      fit(leaves[j], v, b, e);
+      b = e;
+    }
+  }
+
+  void fit(leaf &l, std::span<Key const> v, size_t b, size_t e) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    double count = double(e - b);
+    for (size_t i = b; i < e; ++i) {
+      double x = double(v[i] - first);
+      sx += x;
+      sy += double(i);
+      sxx += x * x;
+      sxy += x * double(i);
+    }
+    double var = count * sxx - sx * sx;
+    l.slope = e - b > 1 && var > 0 ? (count * sxy - sx * sy) / var : 0;
+    l.intercept = e > b ? (sy - l.slope * sx) / count : double(b);
+
+    l.err_lo = l.err_hi = 0;
+    for (size_t i = b; i < e; ++i) {
+      auto err = int64_t(i) - predict(l, v[i]);
+      l.err_lo = (int32_t)std::min<int64_t>(l.err_lo, err);
+      l.err_hi = (int32_t)std::max<int64_t>(l.err_hi, err);
+    }
+    mean_range += double(e - b) * (l.err_hi - l.err_lo + 1) / std::max<size_t>(n, 1);
+  }
+
+  size_t leaf_of(Key x) const {
+    if (x < first)
+      return 0;
+    return std::min(leaves.size() - 1, size_t(double(x - first) * root_slope));
+  }
+
+  int64_t predict(leaf const &l, Key x) const {
+    return int64_t(l.slope * double(x - first) + l.intercept);
+  }
+
+  // Range of v that holds x if x is there.
+  std::pair<size_t, size_t> range(leaf const &l, Key x) const {
+    if (x < first)
+      return {0, 0};
+    auto p = predict(l, x);
+    auto lo = std::clamp<int64_t>(p + l.err_lo, 0, n);
+    auto hi = std::clamp<int64_t>(p + l.err_hi + 1, 0, n);
+    return {size_t(lo), size_t(hi)};
+  }
+
+  bool search(std::span<Key const> v, Key x) const {
+    auto [lo, hi] = range(leaves[leaf_of(x)], x);
+    return range_search(v, lo, hi, x);
+  }
+
+  size_t model_bytes() const { return sizeof(*this) + leaves.size() * sizeof(leaf); }
+};
+
+// Position of x in v[lo, hi), or -1.
+template <typename Key>
+task<ptrdiff_t> CoroRangeSearch(std::span<Key const> v, size_t lo, size_t hi,
+                                Key x) {
+  while (lo < hi) {
+    auto mid = lo + (hi - lo) / 2;
+    auto y = co_await prefetch(v[mid]);
+    if (y == x)
+      co_return ptrdiff_t(mid);
+    if (y < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  co_return -1;
+}
+
+// The ends of the range are next to earlier probes (or the array's ends),
+// only the probes are prefetched.
+template <typename Key, typename Found, typename NotFound>
+root_task CoroInterpolationSearch(std::span<Key const> v, Key x,
+                                  Found on_found, NotFound on_not_found) {
+  size_t lo = 0, hi = v.size();
+  for (int steps = interp_steps; hi - lo > interp_last_mile && steps > 0;
+       --steps) {
+    Key a = v[lo], b = v[hi - 1];
+    if (x < a || b < x)
+      co_return on_not_found();
+    auto pos = interpolate(x, a, b, lo, hi);
+    auto y = co_await prefetch(v[pos]);
+    if (y == x)
+      co_return on_found(pos);
+    if (y < x)
+      lo = pos + 1;
+    else
+      hi = pos;
+  }
+  if (auto pos = co_await CoroRangeSearch(v, lo, hi, x); pos >= 0)
+    co_return on_found(size_t(pos));
+  on_not_found();
+}
+
+template <typename Key, typename Found, typename NotFound>
+root_task CoroRmiSearch(rmi<Key> const &m, std::span<Key const> v, Key x,
+                        Found on_found, NotFound on_not_found) {
+  auto &l = co_await prefetch(m.leaves[m.leaf_of(x)]);
+  auto [lo, hi] = m.range(l, x);
+  if (auto pos = co_await CoroRangeSearch(v, lo, hi, x); pos >= 0)
+    co_return on_found(size_t(pos));
+  on_not_found();
+}
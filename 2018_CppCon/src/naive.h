@@ -1,19 +1,22 @@
 #pragma once
+#include <functional>
 
-template <typename Iterator>
-bool naive_binary_search(Iterator first, Iterator last, int val) {
+template <typename Iterator, typename T, typename Compare = std::less<>>
+bool naive_binary_search(Iterator first, Iterator last, T const &val,
+                         Compare comp = {}) {
   auto len = last - first;
   while (len > 0) {
     const auto half = len / 2;
     const auto middle = first + half;
-    const auto middle_key = *middle;
-    if (middle_key < val) {
+    const auto &middle_key = *middle;
+    const bool less = comp(middle_key, val);
+    if (less) {
       first = middle + 1;
       len = len - half - 1;
     } else {
       len = half;
     }
-    if (middle_key == val)
+    if (!less && !comp(val, middle_key))
       return true;
   }
   return false;
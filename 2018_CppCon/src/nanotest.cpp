@@ -1,137 +1,1255 @@
 #include "naive.h"
 #include "sm.h"
 #include "coro.h"
+#include "gp.h"
+#include "index_file.h"
+#include "amac.h"
+#include "key_stream.h"
+#include "parallel.h"
+#include "simd.h"
+#include "steal.h"
+
+#include "state.h"
+#include "sweep.h"
 
-#include "rng.h"
-#include <chrono>
-#include <ratio>
 #include <stdio.h>
 #include <vector>
 #include <string_view>
 
-// Test state.
-struct State {
-  std::vector<int> v;
-  std::vector<int> lookups;
-  int repeat;
+// see naive.h
+template <typename Key> static long testNaive(BasicState<Key> &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<Key const> keys) {
+    long found = 0;
+    auto beg = s.v.begin();
+    auto end = s.v.end();
+    for (Key key : keys)
+      if (naive_binary_search(beg, end, key))
+        ++found;
+    return found;
+  });
+}
 
-  int streams;
-  char const *algo_name;
+// see sm.h
+template <typename Key> static long testSm(BasicState<Key> &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<Key const> keys) {
+    return SmMultiLookup<Key>(s.v, keys, s.streams);
+  });
+}
 
-  State(int ByteCount, int LookupCount, int Repeat) : repeat(Repeat) {
-    auto seed1 = 0;
+// see sm.h, <streams> above sm_static_max runs the SmMultiLookup.
+static long testSmStatic(State &s) {
+  auto fn = sm_static_dispatch(s.streams);
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return fn ? fn(s.v, keys) : SmMultiLookup<int>(s.v, keys, s.streams);
+  });
+}
 
-    int count = (ByteCount / sizeof(int));
-    v.reserve(count);
-    int val = 0;
-    for (int i = 0; i < count; ++i)
-      v.push_back(i + i);
+// see gp.h, <streams> is the group size.
+static long testGp(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return GroupPrefetchMultiLookup(s.v, keys, s.streams);
+  });
+}
 
-    lookups.reserve(LookupCount);
-    for (auto i : rng<int>(seed1, 0, count + count, LookupCount))
-      lookups.push_back(i);
+// see amac.h, <streams> is the ring size.
+static long testAmac(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return AmacMultiLookup(s.v, keys, s.streams);
+  });
+}
 
-    printf("count: %d lookups: %d repeat %d\n", count, LookupCount, Repeat);
-  }
+// Runs fn(keys, streams) on every worker. Streams is s.streams, or the
+// worker's stream_tuner when <streams> is auto.
+template <typename Key, typename Fn>
+static long parallel_coro(BasicState<Key> &s, Fn fn) {
+  if (s.streams != 0)
+    return parallel_lookup(s.lookups, s.threads,
+                           [&](std::span<Key const> keys, int worker) {
+                             auto scope = s.record_latency(worker);
+                             return fn(keys, s.streams);
+                           });
+
+  s.tuners.resize(s.threads);
+  return parallel_lookup(s.lookups, s.threads,
+                         [&](std::span<Key const> keys, int worker) {
+                           auto scope = s.record_latency(worker);
+                           return fn(keys, s.tuners[worker]);
+                         });
+}
 
-  using hrc_clock = std::chrono::high_resolution_clock;
-  hrc_clock::time_point start_time;
+// see coro.h, every worker thread drives its own throttler.
+template <typename Key> static long testCoro(BasicState<Key> &s) {
+  return parallel_coro(s, [&](std::span<Key const> keys, auto &&streams) {
+    return CoroMultiLookup<Key>(s.v, keys, streams);
+  });
+}
 
-  void start(int streams, const char *algo_name) {
-    this->streams = streams;
-    this->algo_name = algo_name;
-    start_time = hrc_clock::now();
-  }
+// see steal.h, workers steal batches of keys instead of keeping to their
+// static slice.
+static long testNaiveSteal(State &s) {
+  work_stealer stealer(s.lookups.size(), s.threads, steal_batch);
+  auto found = parallel_lookup(
+      s.lookups, s.threads, [&](std::span<int const>, int worker) {
+        long found = 0;
+        for (;;) {
+          auto [first, last] = stealer.claim(worker);
+          if (first == last)
+            break;
+          for (auto i = first; i < last; ++i)
+            if (naive_binary_search(s.v.begin(), s.v.end(), s.lookups[i]))
+              ++found;
+        }
+        return found;
+      });
+  s.stolen = stealer.stolen();
+  return found;
+}
 
-  void stop() {
-    auto stop_time = hrc_clock::now();
-    std::chrono::duration<double, std::nano> elapsed = stop_time - start_time;
+static long testCoroSteal(State &s) {
+  work_stealer stealer(s.lookups.size(), s.threads, steal_batch);
+  if (s.streams == 0)
+    s.tuners.resize(s.threads);
+  auto found = parallel_lookup(
+      s.lookups, s.threads, [&](std::span<int const>, int worker) {
+        auto scope = s.record_latency(worker);
+        auto search = [&](int key, auto on_found, auto on_not_found) {
+          return CoroBinarySearch(s.v.begin(), s.v.end(), key, on_found,
+                                  on_not_found);
+        };
+        if (s.streams != 0)
+          return CoroStealMultiLookup<int>(s.lookups, stealer, worker,
+                                           s.streams, search);
+        return CoroStealMultiLookup<int>(s.lookups, stealer, worker,
+                                         s.tuners[worker], search);
+      });
+  s.stolen = stealer.stolen();
+  return found;
+}
 
-    auto divby = log2((double)v.size());
-    auto perop = elapsed.count() / divby / lookups.size() / repeat;
+static void reportSteal(State &s, long) {
+  printf("stolen batches %zu of %zu keys\n", s.stolen, steal_batch);
+}
+
+// see coro.h, <streams> long-lived coroutines share a cursor over the keys.
+static long testCoroWorkers(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return CoroWorkerMultiLookup<int>(s.v, keys, s.streams);
+  });
+}
 
-    printf("%g ns per lookup/log2(size)\n", perop);
+// see coro.h, results land in s.positions in lookup order.
+static void prepareCoroGet(State &s) { s.positions.resize(s.lookups.size()); }
+
+static long testCoroGet(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    auto out = std::span(s.positions).subspan(keys.data() - s.lookups.data(),
+                                              keys.size());
+    CoroMultiGet(s.v, keys, out, streams);
+    long found = 0;
+    for (auto pos : out)
+      found += pos >= 0;
+    return found;
+  });
+}
+
+// Checks s.positions against naive, a key found must be at its position.
+static bool verifyPositions(State &s) {
+  for (size_t i = 0; i < s.lookups.size(); ++i) {
+    auto key = s.lookups[i];
+    auto pos = s.positions[i];
+    bool expected = naive_binary_search(s.v.begin(), s.v.end(), key);
+    if (expected != (pos >= 0) || (pos >= 0 && s.v[pos] != key)) {
+      printf("!!!! BUG, lookup %zu key %d got position %td\n", i, key, pos);
+      return false;
+    }
   }
-};
+  return true;
+}
 
-// see naive.h
-static long testNaive(State &s) {
-  size_t found = 0;
-  auto beg = s.v.begin();
-  auto end = s.v.end();
-  for (int key : s.lookups)
-    if (naive_binary_search(beg, end, key))
-      ++found;
+static bool verifyCoroGet(State &s) { return verifyPositions(s); }
+
+// see hash.h
+static void prepareHash(State &s) {
+  if (!s.hash)
+    s.hash = std::make_unique<chained_hash_map<int>>(s.v);
+}
+
+static long testHashNaive(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      if (naive_hash_lookup(*s.hash, key))
+        ++found;
+    return found;
+  });
+}
+
+static long testHashSm(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return SmHashMultiLookup(*s.hash, keys, s.streams);
+  });
+}
+
+static long testHashCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroHashMultiLookup(*s.hash, keys, streams);
+  });
+}
+
+// see string_keys.h, the same search over string keys made from s.v.
+static void prepareStrings(State &s) {
+  if (!s.strings)
+    s.strings = std::make_unique<string_keys>(s.v, s.lookups);
+}
+
+// String keys of the lookups in the int keys' slice.
+static std::span<std::string_view const> string_slice(State &s,
+                                                      std::span<int const> keys) {
+  return std::span<std::string_view const>(s.strings->lookups)
+      .subspan(keys.data() - s.lookups.data(), keys.size());
+}
+
+static long testStrNaive(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    auto beg = s.strings->keys.begin();
+    auto end = s.strings->keys.end();
+    for (auto key : string_slice(s, keys))
+      if (naive_binary_search(beg, end, key))
+        ++found;
+    return found;
+  });
+}
+
+static long testStrSm(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return SmStrMultiLookup(s.strings->keys, string_slice(s, keys), s.streams);
+  });
+}
+
+static long testStrCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroMultiLookup<std::string_view>(s.strings->keys,
+                                             string_slice(s, keys), streams);
+  });
+}
+
+// see records.h, index search then record fetch.
+static void prepareRecords(State &s) {
+  if (!s.records)
+    s.records = std::make_unique<record_store>(s.v);
+}
+
+static long testTwoStageNaive(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      if (naive_two_stage_lookup(s.v, *s.records, key))
+        ++found;
+    return found;
+  });
+}
+
+static long testTwoStageCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroTwoStageMultiLookup(s.v, *s.records, keys, streams);
+  });
+}
+
+// see join.h, probes s.join_probe against the hash map of s.v.
+static void prepareJoin(State &s) {
+  prepareHash(s);
+  if (!s.join_probe.empty())
+    return;
+
+  // Generated in parallel from their own counter_rng streams, see state.h.
+  counter_rng gen{3}, coin{4};
+  s.join_probe.resize(s.lookups.size());
+  auto fill = [&](auto rank) {
+    parallel_fill(s.join_probe.size(), [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; ++i) {
+        auto r = rank(i);
+        // Keys in v are never negative, so a negative key has no match.
+        bool match = coin.unit(i) < s.opt.selectivity;
+        s.join_probe[i] = match ? s.v[r] : -1 - (int)r;
+      }
+    });
+  };
+  if (s.opt.skew > 0)
+    fill(zipf_ranks(gen, s.v.size(), s.opt.skew));
+  else
+    fill(uniform_ranks{gen, s.v.size()});
+}
+
+// Runs join(probe, rid, out) or join(probe, rid, out, worker) per worker.
+template <typename Join> static long testJoin(State &s, Join join) {
+  s.join_out.resize(s.threads);
+  auto run = [&](std::span<int const> probe, int worker) -> long {
+    auto scope = s.record_latency(worker);
+    auto &out = s.join_out[worker];
+    out.clear();
+    out.reserve(probe.size());
+    auto rid = uint32_t(probe.data() - s.join_probe.data());
+    if constexpr (std::is_invocable_v<Join &, decltype(probe), uint32_t,
+                                      decltype(out), int>)
+      return join(probe, rid, out, worker);
+    else
+      return join(probe, rid, out);
+  };
+  return parallel_lookup(s.join_probe, s.threads, run);
+}
+
+static long testJoinNaive(State &s) {
+  return testJoin(s, [&](auto probe, uint32_t rid, auto &out) {
+    return NaiveHashJoin(*s.hash, probe, rid, out);
+  });
+}
+
+static long testJoinSm(State &s) {
+  return testJoin(s, [&](auto probe, uint32_t rid, auto &out) {
+    return SmHashJoin(*s.hash, probe, rid, out, s.streams);
+  });
+}
+
+static long testJoinCoro(State &s) {
+  if (s.streams == 0)
+    s.tuners.resize(s.threads);
+  return testJoin(s, [&](auto probe, uint32_t rid, auto &out, int worker) {
+    if (s.streams != 0)
+      return CoroHashJoin(*s.hash, probe, rid, out, s.streams);
+    return CoroHashJoin(*s.hash, probe, rid, out, s.tuners[worker]);
+  });
+}
+
+static void reportJoin(State &s, long sum) {
+  printf("%g Mtuples/s, selectivity %g skew %g\n",
+         sum / (s.elapsed_ns * 1e-9) / 1e6, s.opt.selectivity, s.opt.skew);
+}
+
+// see layout.h
+static void prepareEytzinger(State &s) {
+  if (!s.eyt)
+    s.eyt = std::make_unique<eytzinger<int>>(s.v);
+}
+
+static void prepareSTree(State &s) {
+  if (!s.btree)
+    s.btree = std::make_unique<stree<int>>(s.v);
+}
+
+template <typename Layout, bool (Layout::*Search)(int) const>
+static long testLayout(State &s, Layout const &layout) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      if ((layout.*Search)(key))
+        ++found;
+    return found;
+  });
+}
+
+static long testEytNaive(State &s) {
+  return testLayout<eytzinger<int>, &eytzinger<int>::naive_search>(s, *s.eyt);
+}
+
+static long testEytBranchless(State &s) {
+  return testLayout<eytzinger<int>, &eytzinger<int>::branchless_search>(s, *s.eyt);
+}
+
+static long testEytPrefetch(State &s) {
+  return testLayout<eytzinger<int>, &eytzinger<int>::prefetch_search>(s, *s.eyt);
+}
+
+static long testEytCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroSearchMultiLookup(keys, streams, [&](int key, auto... cb) {
+      return CoroEytzingerSearch(*s.eyt, key, cb...);
+    });
+  });
+}
+
+static long testBtreeNaive(State &s) {
+  return testLayout<stree<int>, &stree<int>::naive_search>(s, *s.btree);
+}
+
+static long testBtreeBranchless(State &s) {
+  return testLayout<stree<int>, &stree<int>::branchless_search>(s, *s.btree);
+}
+
+static long testBtreePrefetch(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return s.btree->prefetch_search(keys, s.streams);
+  });
+}
+
+static long testBtreeCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroSearchMultiLookup(keys, streams, [&](int key, auto... cb) {
+      return CoroSTreeSearch(*s.btree, key, cb...);
+    });
+  });
+}
+
+// see learned.h
+static long testInterpNaive(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      if (interpolation_search(s.v, key))
+        ++found;
+    return found;
+  });
+}
+
+static long testInterpCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroSearchMultiLookup(keys, streams, [&](int key, auto on_found,
+                                                    auto on_not_found) {
+      return CoroInterpolationSearch(s.v, key, on_found, on_not_found);
+    });
+  });
+}
+
+// Reruns search(key, on_found(pos), on_not_found) over the lookups untimed,
+// collecting the positions found, and checks them against naive.
+template <typename Search>
+static bool verifySearchPositions(State &s, Search search) {
+  s.positions.assign(s.lookups.size(), -1);
+  struct {
+    std::span<ptrdiff_t> out;
+    auto on_found(size_t i) {
+      return [slot = &out[i]](size_t pos) { *slot = pos; };
+    }
+    auto on_not_found(size_t) {
+      return [] {};
+    }
+  } sink{s.positions};
+  CoroSearchAll<int>(s.lookups, 16, search, sink);
+  return verifyPositions(s);
+}
+
+static bool verifyInterpCoro(State &s) {
+  return verifySearchPositions(s, [&](int key, auto... cb) {
+    return CoroInterpolationSearch(s.v, key, cb...);
+  });
+}
+
+static void reportInterp(State &, long) { printf("model 0 bytes\n"); }
+
+static void prepareRmi(State &s) {
+  if (!s.rmi_model)
+    s.rmi_model = std::make_unique<rmi<int>>(s.v);
+}
+
+static long testRmiNaive(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      if (s.rmi_model->search(s.v, key))
+        ++found;
+    return found;
+  });
+}
+
+static long testRmiCoro(State &s) {
+  return parallel_coro(s, [&](std::span<int const> keys, auto &&streams) {
+    return CoroSearchMultiLookup(keys, streams, [&](int key, auto on_found,
+                                                    auto on_not_found) {
+      return CoroRmiSearch(*s.rmi_model, s.v, key, on_found, on_not_found);
+    });
+  });
+}
+
+static bool verifyRmiCoro(State &s) {
+  return verifySearchPositions(s, [&](int key, auto... cb) {
+    return CoroRmiSearch(*s.rmi_model, s.v, key, cb...);
+  });
+}
+
+static void reportRmi(State &s, long) {
+  auto &m = *s.rmi_model;
+  printf("model %zu bytes, %zu leaves, last mile %g keys\n", m.model_bytes(),
+         m.leaves.size(), m.mean_range);
+}
+
+// see simd.h
+static void prepareSimd(State &) {
+  static bool once = false;
+  char const *isa;
+  simd_lookup_dispatch(&isa);
+  if (!once)
+    fprintf(stderr, "simd: using %s\n", isa);
+  once = true;
+}
+
+static long testSimd(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return SimdMultiLookup(s.v, keys);
+  });
+}
+
+static long testSimdScalar(State &s) {
+  return parallel_lookup(s.lookups, s.threads, [&](std::span<int const> keys) {
+    return simd_lookup_scalar(s.v, keys);
+  });
+}
+
+// see key_stream.h, one pass over keys streamed from --keys on one thread.
+static long streamNaive(State &s, key_stream &in) {
+  long found = 0;
+  for (auto chunk = in.next(); !chunk.empty(); chunk = in.next())
+    for (int key : chunk)
+      if (naive_binary_search(s.v.begin(), s.v.end(), key))
+        ++found;
   return found;
 }
 
-// see sm.h
-static long testSm(State &s) {
-  return SmMultiLookup(s.v, s.lookups, s.streams);
+// The state machine drains its frames at the end of every chunk.
+static long streamSm(State &s, key_stream &in) {
+  long found = 0;
+  for (auto chunk = in.next(); !chunk.empty(); chunk = in.next())
+    found += SmMultiLookup<int>(s.v, chunk, s.streams);
+  return found;
 }
 
-// see coro.h
-long testCoro(State& s){
-  return CoroMultiLookup(s.v, s.lookups, s.streams);
+static long streamCoro(State &s, key_stream &in) {
+  if (s.streams != 0)
+    return CoroStreamMultiLookup(s.v, in, s.streams);
+  s.tuners.resize(1);
+  return CoroStreamMultiLookup(s.v, in, s.tuners[0]);
 }
 
-using TestFn = long (*)(State& s);
+struct StreamAlgo {
+  char const *name;
+  long (*fn)(State &s, key_stream &in);
+};
+
+static constexpr StreamAlgo stream_algos[] = {
+    {"naive", &streamNaive},
+    {"sm", &streamSm},
+    {"coro", &streamCoro},
+};
+
+static constexpr Algo algos[] = {
+    {.name = "naive", .fn = &testNaive<int>},
+    {.name = "sm", .fn = &testSm<int>, .uses_streams = true},
+    {.name = "sm-static", .fn = &testSmStatic, .uses_streams = true},
+    {.name = "gp", .fn = &testGp, .uses_streams = true},
+    {.name = "amac", .fn = &testAmac, .uses_streams = true},
+    {.name = "coro", .fn = &testCoro<int>, .uses_streams = true,
+     .adaptive = true},
+    {.name = "coro-workers", .fn = &testCoroWorkers, .uses_streams = true},
+    {.name = "naive-steal", .fn = &testNaiveSteal, .report = &reportSteal},
+    {.name = "coro-steal", .fn = &testCoroSteal, .uses_streams = true,
+     .adaptive = true, .report = &reportSteal},
+    {.name = "coro-get", .fn = &testCoroGet, .uses_streams = true,
+     .prepare = &prepareCoroGet, .adaptive = true, .verify = &verifyCoroGet},
+    {.name = "hash-naive", .fn = &testHashNaive, .prepare = &prepareHash},
+    {.name = "hash-sm", .fn = &testHashSm, .uses_streams = true,
+     .prepare = &prepareHash},
+    {.name = "hash-coro", .fn = &testHashCoro, .uses_streams = true,
+     .prepare = &prepareHash, .adaptive = true},
+    {.name = "eyt-naive", .fn = &testEytNaive, .prepare = &prepareEytzinger},
+    {.name = "eyt-branchless", .fn = &testEytBranchless,
+     .prepare = &prepareEytzinger},
+    {.name = "eyt-prefetch", .fn = &testEytPrefetch,
+     .prepare = &prepareEytzinger},
+    {.name = "eyt-coro", .fn = &testEytCoro, .uses_streams = true,
+     .prepare = &prepareEytzinger, .adaptive = true},
+    {.name = "btree-naive", .fn = &testBtreeNaive, .prepare = &prepareSTree},
+    {.name = "btree-branchless", .fn = &testBtreeBranchless,
+     .prepare = &prepareSTree},
+    {.name = "btree-prefetch", .fn = &testBtreePrefetch, .uses_streams = true,
+     .prepare = &prepareSTree},
+    {.name = "btree-coro", .fn = &testBtreeCoro, .uses_streams = true,
+     .prepare = &prepareSTree, .adaptive = true},
+    {.name = "str-naive", .fn = &testStrNaive, .prepare = &prepareStrings},
+    {.name = "str-sm", .fn = &testStrSm, .uses_streams = true,
+     .prepare = &prepareStrings},
+    {.name = "str-coro", .fn = &testStrCoro, .uses_streams = true,
+     .prepare = &prepareStrings, .adaptive = true},
+    {.name = "twostage-naive", .fn = &testTwoStageNaive,
+     .prepare = &prepareRecords},
+    {.name = "twostage-coro", .fn = &testTwoStageCoro, .uses_streams = true,
+     .prepare = &prepareRecords, .adaptive = true},
+    {.name = "join-naive", .fn = &testJoinNaive, .prepare = &prepareJoin,
+     .reference = &testJoinNaive, .report = &reportJoin},
+    {.name = "join-sm", .fn = &testJoinSm, .uses_streams = true,
+     .prepare = &prepareJoin, .reference = &testJoinNaive,
+     .report = &reportJoin},
+    {.name = "join-coro", .fn = &testJoinCoro, .uses_streams = true,
+     .prepare = &prepareJoin, .adaptive = true, .reference = &testJoinNaive,
+     .report = &reportJoin},
+    {.name = "interp-naive", .fn = &testInterpNaive, .report = &reportInterp},
+    {.name = "interp-coro", .fn = &testInterpCoro, .uses_streams = true,
+     .adaptive = true, .verify = &verifyInterpCoro, .report = &reportInterp},
+    {.name = "rmi-naive", .fn = &testRmiNaive, .prepare = &prepareRmi,
+     .report = &reportRmi},
+    {.name = "rmi-coro", .fn = &testRmiCoro, .uses_streams = true,
+     .prepare = &prepareRmi, .adaptive = true, .verify = &verifyRmiCoro,
+     .report = &reportRmi},
+    {.name = "simd", .fn = &testSimd, .prepare = &prepareSimd},
+    {.name = "simd-scalar", .fn = &testSimdScalar},
+};
+
+static Algo const *find_algo(std::string_view name) {
+  for (auto &a : algos)
+    if (name == a.name)
+      return &a;
+  return nullptr;
+}
 
 int usage(const char* msg = nullptr) {
   puts("");
   if (msg) puts(msg);
 
-  printf("  Usage: nanotest <algo> <size> <streams>\n\n"
+  printf("  Usage: nanotest [<options>] <algo> <size> <streams> [<threads>]\n"
+         "         nanotest [<options>] sweep [<sweep options>]\n"
+         "         nanotest [--key=<type>] index <file> [<size>]\n"
+         "         nanotest frames\n"
+         "         nanotest checksum <file>\n\n"
           "   <algo>: naive sm coro\n"
-          "   <size>: l1 l2 l3 big\n"
-          "   <streams>: 1 - whatever\n\n");
+          "           sm-static (sm compiled for 1 to 32 streams, unrolled)\n"
+          "           gp amac (group prefetching and AMAC, <streams> is the\n"
+          "           group or ring size)\n"
+          "           coro-workers (<streams> coroutines loop over the keys)\n"
+          "           naive-steal coro-steal (threads steal batches of keys\n"
+          "           from each other instead of keeping to their slice)\n"
+          "           coro-get (multi-get of positions, checked against naive)\n"
+          "           hash-naive hash-sm hash-coro (chained hash map probes)\n"
+          "           eyt-naive eyt-branchless eyt-prefetch eyt-coro\n"
+          "           btree-naive btree-branchless btree-prefetch btree-coro\n"
+          "           (Eytzinger and 16-way B-tree layouts, btree-prefetch\n"
+          "           descends <streams> searches level by level)\n"
+          "           str-naive str-sm str-coro (binary search of string_view\n"
+          "           keys, slot and characters are separate misses)\n"
+          "           twostage-naive twostage-coro (index search, then fetch\n"
+          "           of the record it points to, as nested coroutines)\n"
+          "           join-naive join-sm join-coro (hash join probe of\n"
+          "           <lookups> probe tuples against the array's keys)\n"
+          "           interp-naive interp-coro rmi-naive rmi-coro (interpolation\n"
+          "           search and a two-stage learned index, each finishing\n"
+          "           with a bounded binary search, the coro positions found\n"
+          "           are checked against naive)\n"
+          "           simd simd-scalar (8/16 wide branchless binary search,\n"
+          "           AVX-512 or AVX2 picked at run time, and its fallback)\n"
+          "   <size>: quick l1 l2 l3 big or a byte count (16K, 6M, 1G)\n"
+          "   <streams>: 1 - whatever, or auto for the coroutine engines to\n"
+          "              hill-climb the number of lookups in flight\n"
+          "   <threads>: 1 (default) - whatever, lookups are split evenly\n"
+          "              across worker threads pinned to separate cpus\n"
+          "   --perf: hardware counters per lookup, comma separated groups\n"
+          "           ipc cache tlb stall default or counters joined by '+'\n"
+          "           cycles instructions l1d-misses llc-misses dtlb-misses\n"
+          "           stalls-backend l1d-pending l1d-stalls r<hex>\n"
+          "   --key: key type i32 (default) u32 u64 u128, all but i32 run\n"
+          "           naive sm coro only, u64 and u128 sizes go up to 1T\n"
+          "   --data: generated keys uniform (default) or skewed, the expected\n"
+          "           result of skewed keys is computed with naive\n"
+          "   --dist: lookups uniform (default), phased (first half hot),\n"
+          "           zipf, hotspot or sequential (runs of keys), see state.h\n"
+          "   --hit-ratio: fraction of the lookups found, default 0.5, with\n"
+          "           uniform it picks array keys instead of values\n"
+          "   --theta: zipf theta in [0, 1) of zipf lookups, default 0.99\n"
+          "   --hot=<keys>,<share>: hotspot lookups, a <share> of the lookups\n"
+          "           go to a range of <keys> of the keys, default 0.01,0.9\n"
+          "   --run=<n>: keys per run of sequential lookups, default 64\n"
+          "   --pages: pages backing the array and lookups\n"
+          "           system (default) 4k thp 2m 1g\n"
+          "   --selectivity: fraction of join probes with a match, default 0.5\n"
+          "   --skew: zipf theta in [0, 1) of join probe keys, default 0\n"
+          "   --keys=<file>: look up the native 32 bit ints in <file>, or\n"
+          "           stdin for '-', instead of random keys (naive sm coro,\n"
+          "           one thread, one pass)\n"
+          "   --chunk=<n>: keys read from --keys at a time, default 64K\n"
+          "   --index=<file>: search the keys mapped from an index file, pass\n"
+          "           - as <size>, the key type comes from the file\n"
+          "   --cold: drop the index from the page cache before timing\n"
+          "   --latency: p50/p99/p99.9 of spawn to completion of every lookup\n"
+          "           of the coroutine engines, also added to sweep output\n"
+          "   --frames: coroutine frame pool counters of all threads after\n"
+          "           the run\n\n"
+          "  index <file> <size> writes the index of the generated array,\n"
+          "  index <file> checks the checksum of one.\n"
+          "  checksum <file> checks that flipping a high bit of a key in an\n"
+          "  index is caught, <file> is scratch.\n"
+          "  frames checks that coroutine frames freed on another thread\n"
+          "  return to their pool.\n\n"
+          "  Sweep options, lists are comma separated:\n"
+          "   --algos=<list>    default: all\n"
+          "   --sizes=<list>    byte counts, default: 16K,200K,6M,256M\n"
+          "   --streams=<list>  default: 1,2,4,8,16,32, auto is reported as 0\n"
+          "   --threads=<list>  default: 1\n"
+          "   --lookups=<n>     per pass, default: 1M\n"
+          "   --repeat=<n>      passes per run, default: 1\n"
+          "   --warmup=<n>      untimed runs per point, default: 2\n"
+          "   --runs=<n>        timed runs per point, default: 11\n"
+          "   --format=csv|json default: csv\n"
+          "   --baseline=<csv>  earlier sweep to compare medians against\n"
+          "   --tolerance=<pct> slowdown flagged as regression, default: 5\n"
+          "  Reports ns per lookup/log2(size). Exits with 2 on a regression.\n\n");
   return 1;
 }
 
+static int sweep(int argc, const char** argv, Options const &options) {
+  Sweep sw;
+  sw.options = options;
+  for (auto &a : algos)
+    sw.algos.push_back(&a);
+  sw.sizes = {16 * 1024, 200 * 1024, 6 * 1024 * 1024, 256 * 1024 * 1024};
+  sw.streams = {1, 2, 4, 8, 16, 32};
+  sw.threads = {1};
+
+  auto parse_ints = [](std::string_view list, std::vector<int> &out,
+                       bool allow_auto = false) {
+    out.clear();
+    for (auto item : split_list(list)) {
+      if (allow_auto && item == "auto") {
+        out.push_back(0);
+        continue;
+      }
+      int n = atoi(std::string(item).c_str());
+      if (n < 1)
+        return false;
+      out.push_back(n);
+    }
+    return !out.empty();
+  };
+  auto parse_int = [](std::string_view str, int &out, int min) {
+    out = atoi(std::string(str).c_str());
+    return out >= min;
+  };
+
+  for (int i = 0; i < argc; ++i) {
+    std::string_view opt = argv[i], value;
+    bool ok = true;
+    if (match_option(opt, "algos", value)) {
+      sw.algos.clear();
+      for (auto name : split_list(value))
+        if (auto a = find_algo(name))
+          sw.algos.push_back(a);
+        else
+          ok = false;
+    } else if (match_option(opt, "sizes", value)) {
+      sw.sizes.clear();
+      for (auto item : split_list(value)) {
+        auto size = parse_size(item);
+        ok = ok && size >= 2 * sizeof(int) && size <= (4ull << 30);
+        sw.sizes.push_back(size);
+      }
+    } else if (match_option(opt, "streams", value))
+      ok = parse_ints(value, sw.streams, true);
+    else if (match_option(opt, "threads", value))
+      ok = parse_ints(value, sw.threads);
+    else if (match_option(opt, "lookups", value)) {
+      auto n = parse_size(value);
+      sw.lookups = (int)n;
+      ok = n > 0 && n < (1u << 31);
+    } else if (match_option(opt, "repeat", value))
+      ok = parse_int(value, sw.repeat, 1);
+    else if (match_option(opt, "warmup", value))
+      ok = parse_int(value, sw.warmup, 0);
+    else if (match_option(opt, "runs", value))
+      ok = parse_int(value, sw.runs, 1);
+    else if (match_option(opt, "format", value)) {
+      sw.json = value == "json";
+      ok = value == "json" || value == "csv";
+    } else if (match_option(opt, "baseline", value))
+      ok = sw.load_baseline(value.data()); // value runs to the end of argv[i]
+    else if (match_option(opt, "tolerance", value))
+      sw.tolerance = atof(std::string(value).c_str());
+    else
+      ok = false;
+
+    if (!ok || sw.algos.empty() || sw.sizes.empty()) {
+      fprintf(stderr, "invalid sweep option %s\n", argv[i]);
+      return usage();
+    }
+  }
+
+  return sw.run(*find_algo("naive"));
+}
+
+// Runs algo over the keys in path, as they are read.
+static int stream(State &s, char const *name, int streams,
+                  std::string_view path, size_t chunk) {
+  StreamAlgo const *algo = nullptr;
+  for (auto &a : stream_algos)
+    if (name == std::string_view(a.name))
+      algo = &a;
+  if (!algo)
+    return usage("--keys works with naive sm coro\n\n");
+
+  key_stream in(path, chunk);
+  if (!in.ok())
+    return 1;
+
+  auto naive = [&](std::span<int const> keys) {
+    long found = 0;
+    for (int key : keys)
+      found += naive_binary_search(s.v.begin(), s.v.end(), key);
+    return found;
+  };
+
+  // Stdin can only be read once, so naive checks every chunk as it arrives
+  // and its time is taken out of the measurement (not out of --perf). A file
+  // is read again afterwards with plain fread, which also catches keys
+  // key_stream loses at chunk boundaries.
+  long expected = 0;
+  size_t expected_count = 0;
+  double check_ns = 0;
+  bool from_stdin = path == "-";
+  if (from_stdin)
+    in.observer = [&](std::span<int const> keys) {
+      auto t0 = std::chrono::steady_clock::now();
+      expected += naive(keys);
+      expected_count += keys.size();
+      std::chrono::duration<double, std::nano> spent =
+          std::chrono::steady_clock::now() - t0;
+      check_ns += spent.count();
+    };
+
+  s.start(streams, 1, name);
+  auto found = algo->fn(s, in);
+  s.streamed = in.count();
+  s.stop();
+  s.elapsed_ns -= check_ns;
+  printf("%zu keys\n", in.count());
+  s.report();
+  printf("found %ld\n", found);
+
+  if (!from_stdin) {
+    auto f = fopen(std::string(path).c_str(), "rb");
+    if (!f) {
+      perror("keys: reopen");
+      return 1;
+    }
+    std::vector<int> keys(64 * 1024);
+    while (auto n = fread(keys.data(), sizeof(int), keys.size(), f)) {
+      expected += naive(std::span<int const>(keys.data(), n));
+      expected_count += n;
+    }
+    fclose(f);
+  }
+  if (found != expected || in.count() != expected_count) {
+    printf("!!!! BUG, expected %ld found in %zu keys\n", expected,
+           expected_count);
+    return 1;
+  }
+  return 0;
+}
+
 struct TestParam {
-  int SizeInBytes;
+  size_t SizeInBytes;
   int LookupSize;
   int Repeat;
 
-  long ExpectedResult; // sanity check for bugs
+  long ExpectedResult; // sanity check for bugs, -1 to compare against naive
 };
 
 using namespace std;
 
+static root_task idle_frame(int) { co_return; }
+
+// Its frame holds buf, too large for the pool's size classes.
+static root_task large_frame(int i) {
+  char buf[2 * frame_pool::max_size];
+  buf[i % sizeof(buf)] = char(i);
+  co_await std::experimental::suspend_always{};
+  printf("%d\n", buf[i % sizeof(buf)]);
+}
+
+// nanotest frames: coroutine frames created on one thread and destroyed on
+// another go back to their pool through its remote list, after which the
+// pool has nothing outstanding and reuses the blocks.
+static int frames_command() {
+  constexpr int count = 10000;
+  auto &pool = frame_pool::local();
+
+  std::vector<root_task> tasks;
+  tasks.reserve(count);
+  for (int i = 0; i < count; ++i)
+    tasks.push_back(idle_frame(i));
+  std::thread([&] { tasks.clear(); }).join();
+
+  auto freed = pool.stats();
+  freed.print();
+  if (freed.remote_frees != count || freed.outstanding != 0) {
+    printf("!!!! BUG, expected %d remote frees and 0 outstanding\n", count);
+    return 1;
+  }
+
+  // The next allocations take the remotely freed blocks back.
+  for (int i = 0; i < count; ++i)
+    tasks.push_back(idle_frame(i));
+  tasks.clear();
+  auto reused = pool.stats();
+  reused.print();
+  if (reused.misses != freed.misses || reused.outstanding != 0) {
+    printf("!!!! BUG, remotely freed frames were not reused\n");
+    return 1;
+  }
+
+  // Frames too large for the size classes go back to their pool's counters
+  // too, not to the freeing thread's.
+  constexpr int large = 100;
+  for (int i = 0; i < large; ++i)
+    tasks.push_back(large_frame(i));
+  frame_pool::counters thief;
+  std::thread([&] {
+    tasks.clear();
+    thief = frame_pool::local().stats();
+  }).join();
+  auto big = pool.stats();
+  big.print();
+  if (big.misses != reused.misses + large ||
+      big.remote_frees != reused.remote_frees + large ||
+      big.outstanding != 0 || thief.outstanding != 0) {
+    printf("!!!! BUG, expected %d large remote frees and 0 outstanding\n",
+           large);
+    return 1;
+  }
+  return 0;
+}
+
+// Writes a small index of Key to path, flips the top bit of one key in the
+// file and checks that verify() fails and that the low half of the checksum
+// changed as well.
+template <typename Key> static bool checksum_flip(char const *path) {
+  constexpr uint64_t count = 1000, victim = 321;
+  if (!write_index<Key>(path, count))
+    return false;
+  uint64_t before;
+  {
+    index_file index(path);
+    if (!index.ok() || !index.verify()) {
+      printf("!!!! BUG, fresh %s index does not verify\n",
+             key_type_name(key_type_of<Key>()));
+      return false;
+    }
+    before = index.header().checksum;
+  }
+
+  Key key;
+  auto at = off_t(index_header::keys_offset + victim * sizeof(Key));
+  int fd = open(path, O_RDWR);
+  bool ok = fd >= 0 && pread(fd, &key, sizeof(key), at) == sizeof(key);
+  key ^= Key(1) << (8 * sizeof(Key) - 1);
+  ok = ok && pwrite(fd, &key, sizeof(key), at) == sizeof(key);
+  if (fd >= 0)
+    close(fd);
+  if (!ok) {
+    perror("checksum: flip");
+    return false;
+  }
+
+  index_file index(path);
+  index_checksum sum;
+  sum.add(index.keys<Key>().data(), count * sizeof(Key));
+  auto after = sum.value();
+  printf("%s: checksum %016llx, top bit of key %llu flipped %016llx\n",
+         key_type_name(key_type_of<Key>()), (unsigned long long)before,
+         (unsigned long long)victim, (unsigned long long)after);
+  if (index.verify() || uint32_t(after) == uint32_t(before)) {
+    printf("!!!! BUG, flipped high bit not caught by the low half\n");
+    return false;
+  }
+  return true;
+}
+
+// nanotest checksum <file>: checksum_flip for each unsigned key type, <file>
+// is scratch and removed afterwards.
+static int checksum_command(int argc, const char **argv) {
+  if (argc != 1)
+    return usage();
+  bool ok = checksum_flip<uint32_t>(argv[0]) &&
+            checksum_flip<uint64_t>(argv[0]) &&
+            checksum_flip<unsigned __int128>(argv[0]);
+  unlink(argv[0]);
+  return ok ? 0 : 1;
+}
+
+// nanotest index <file> <size> writes the index nanotest would generate for
+// <size>, nanotest index <file> checks one.
+static int index_command(int argc, const char **argv, key_type key) {
+  if (argc == 1) {
+    index_file index(argv[0]);
+    if (!index.ok())
+      return 1;
+    index.print();
+    if (!index.verify()) {
+      printf("!!!! checksum mismatch\n");
+      return 1;
+    }
+    printf("checksum ok\n");
+    return 0;
+  }
+  if (argc != 2)
+    return usage();
+
+  auto size = parse_size(argv[1]);
+  uint64_t count = size / key_type_size(key);
+  if (count == 0 ||
+      (key_type_size(key) == 4 && size > (4ull << 30)))
+    return usage("invalid size\n\n");
+
+  bool ok = false;
+  switch (key) {
+  case key_type::i32: ok = write_index<int>(argv[0], count); break;
+  case key_type::u32: ok = write_index<uint32_t>(argv[0], count); break;
+  case key_type::u64: ok = write_index<uint64_t>(argv[0], count); break;
+  case key_type::u128:
+    ok = write_index<unsigned __int128>(argv[0], count);
+    break;
+  }
+  if (!ok)
+    return 1;
+  index_file(argv[0]).print();
+  return 0;
+}
+
+// Runs naive, sm or coro over an array of Key, see BasicState. The expected
+// results of the named sizes are for int keys, so the result counted by the
+// generator is used, or naive computes it.
+template <typename Key>
+static int run_keyed(char const *name, TestParam param, int streams,
+                     int threads, Options const &options,
+                     string_view perf_spec, index_file const *index,
+                     bool cold) {
+  long (*fn)(BasicState<Key> &) = nullptr;
+  if (name == "naive"sv)
+    fn = &testNaive<Key>;
+  else if (name == "sm"sv)
+    fn = &testSm<Key>;
+  else if (name == "coro"sv)
+    fn = &testCoro<Key>;
+  else
+    return usage("--key works with naive sm coro\n\n");
+
+  BasicState<Key> s(param.SizeInBytes, param.LookupSize, param.Repeat, options,
+                    index ? index->keys<Key>() : std::span<Key const>());
+  s.print();
+  if (!s.perf.open(perf_spec))
+    return usage("invalid perf counter\n\n");
+
+  long expected = s.expected;
+  if (expected < 0) {
+    s.start(1, 1, "reference");
+    expected = testNaive(s);
+  }
+  expected *= s.repeat;
+  if (cold)
+    index->drop_cache();
+
+  s.start(streams, threads, name);
+  long sum = 0;
+  for (int repeat = s.repeat; repeat > 0; --repeat)
+    sum += fn(s);
+  s.stop();
+  s.report();
+  printf("sum %ld\n", sum);
+  if (sum != expected) {
+    printf("!!!! BUG, expected %ld\n", expected);
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, const char** argv) {
-  if (argc != 4)
+  string_view perf_spec;
+  string_view keys_path;
+  string_view index_path;
+  bool cold = false;
+  size_t chunk = 64 * 1024;
+  Options options;
+  while (argc > 1 && argv[1][0] == '-') {
+    string_view opt = argv[1], value;
+    if (match_option(opt, "perf", value))
+      perf_spec = value;
+    else if (opt == "--perf")
+      perf_spec = "default";
+    else if (match_option(opt, "dist", value)) {
+      if (!parse_lookup_dist(value, options.dist))
+        return usage("invalid lookup distribution\n\n");
+    } else if (match_option(opt, "data", value)) {
+      if (!parse_key_data(value, options.data))
+        return usage("invalid key distribution\n\n");
+    } else if (match_option(opt, "key", value)) {
+      if (!parse_key_type(value, options.key))
+        return usage("invalid key type\n\n");
+    } else if (match_option(opt, "pages", value)) {
+      if (!parse_page_mode(value, options.pages))
+        return usage("invalid page size\n\n");
+    } else if (match_option(opt, "selectivity", value)) {
+      options.selectivity = atof(string(value).c_str());
+      if (options.selectivity < 0 || options.selectivity > 1)
+        return usage("invalid selectivity\n\n");
+    } else if (match_option(opt, "skew", value)) {
+      options.skew = atof(string(value).c_str());
+      if (options.skew < 0 || options.skew >= 1)
+        return usage("invalid skew\n\n");
+    } else if (match_option(opt, "hit-ratio", value)) {
+      options.hit_ratio = atof(string(value).c_str());
+      if (options.hit_ratio < 0 || options.hit_ratio > 1)
+        return usage("invalid hit ratio\n\n");
+    } else if (match_option(opt, "theta", value)) {
+      options.theta = atof(string(value).c_str());
+      if (options.theta < 0 || options.theta >= 1)
+        return usage("invalid theta\n\n");
+    } else if (match_option(opt, "hot", value)) {
+      auto comma = value.find(',');
+      options.hot_keys = atof(string(value.substr(0, comma)).c_str());
+      if (comma != string_view::npos)
+        options.hot_share = atof(string(value.substr(comma + 1)).c_str());
+      if (options.hot_keys <= 0 || options.hot_keys > 1 ||
+          options.hot_share < 0 || options.hot_share > 1)
+        return usage("invalid hotspot\n\n");
+    } else if (match_option(opt, "run", value)) {
+      options.run = parse_size(value);
+      if (options.run == 0)
+        return usage("invalid run length\n\n");
+    } else if (match_option(opt, "keys", value))
+      keys_path = value;
+    else if (match_option(opt, "index", value))
+      index_path = value;
+    else if (opt == "--cold")
+      cold = true;
+    else if (opt == "--latency")
+      options.latency = true;
+    else if (opt == "--frames")
+      options.frames = true;
+    else if (match_option(opt, "chunk", value)) {
+      chunk = parse_size(value);
+      if (chunk == 0)
+        return usage("invalid chunk size\n\n");
+    } else
+      return usage("invalid option\n\n");
+    ++argv;
+    --argc;
+  }
+
+  if (argc > 1 && argv[1] == "sweep"sv) {
+    if (options.key != key_type::i32 || !index_path.empty() || cold)
+      return usage("sweep runs generated i32 keys\n\n");
+    return sweep(argc - 2, argv + 2, options);
+  }
+
+  if (argc > 1 && argv[1] == "frames"sv)
+    return frames_command();
+
+  if (argc > 1 && argv[1] == "checksum"sv)
+    return checksum_command(argc - 2, argv + 2);
+
+  if (argc > 1 && argv[1] == "index"sv)
+    return index_command(argc - 2, argv + 2, options.key);
+
+  if (argc != 4 && argc != 5)
     return usage();
 
-  TestFn testFn = nullptr;
-  if (argv[1] == "coro"sv) testFn = &testCoro;
-  else if (argv[1] == "naive"sv) testFn = &testNaive;
-  else if (argv[1] == "sm"sv) testFn = &testSm;
-  else return usage("invalid algorithm name\n\n");
+  // The array comes from the index file, so does the key type.
+  std::unique_ptr<index_file> index;
+  if (!index_path.empty()) {
+    index = std::make_unique<index_file>(index_path);
+    if (!index->ok())
+      return 1;
+    index->print();
+    options.key = index->key();
+  } else if (cold)
+    return usage("--cold needs --index\n\n");
+
+  auto algo = find_algo(argv[1]);
+  if (!algo)
+    return usage("invalid algorithm name\n\n");
+
+  // 32 bit keys run out at 2^31, the values are 2 * index.
+  auto max_bytes = options.key == key_type::i32 || options.key == key_type::u32
+                       ? 4ull << 30
+                       : 1ull << 40;
 
   TestParam param;
-  if (argv[2] == "quick"sv)    param = TestParam{ 16*1024, 1024, 1,            505};
+  if (index) {
+    if (argv[2] != "-"sv)
+      return usage("pass - as the size with --index\n\n");
+    param = TestParam{index->header().count * index->header().key_size,
+                      1024*1024, 1, -1};
+  }
+  else if (argv[2] == "quick"sv)    param = TestParam{ 16*1024, 1024, 1,            505};
   else if (argv[2] == "l1"sv)  param = TestParam{ 16*1024, 1024, 10000,        5050000};
-  else if (argv[2] == "l2"sv)  param = TestParam{200*1024, 1024*1024, 50,      26225050};
-  else if (argv[2] == "l3"sv)  param = TestParam{6*1024*1024, 1024*1024, 50,   26215900};
-  else if (argv[2] == "big"sv) param = TestParam{256*1024*1024, 1024*1024, 5,  2624940};
+  else if (argv[2] == "l2"sv)  param = TestParam{200*1024, 1024*1024, 50,      26255350};
+  else if (argv[2] == "l3"sv)  param = TestParam{6*1024*1024, 1024*1024, 50,   26204500};
+  else if (argv[2] == "big"sv) param = TestParam{256*1024*1024, 1024*1024, 5,  2619855};
+  else if (auto size = parse_size(argv[2]); size >= 2 * sizeof(int) && size <= max_bytes)
+    param = TestParam{size, 1024*1024, 1, -1};
   else return usage("invalid size\n\n");
+  // Other workloads than the tabled one take the count from the generator.
+  if (options.data != key_data::uniform ||
+      options.dist != lookup_dist::uniform || options.ranked())
+    param.ExpectedResult = -1;
 
-  auto streams = atoi(argv[3]);
-  if (streams < 1)
+  auto streams = argv[3] == "auto"sv ? 0 : atoi(argv[3]);
+  if (streams < 1 && !(streams == 0 && argv[3] == "auto"sv && algo->adaptive))
     return usage("invalid stream count");
 
-  State s(param.SizeInBytes, param.LookupSize, param.Repeat);
+  auto threads = argc == 5 ? atoi(argv[4]) : 1;
+  if (threads < 1)
+    return usage("invalid thread count");
+
+  if (!keys_path.empty() && threads != 1)
+    return usage("--keys runs on one thread\n\n");
+  if (!keys_path.empty() && options.key != key_type::i32)
+    return usage("--keys reads i32 keys\n\n");
+
+  switch (options.key) {
+  case key_type::i32: break;
+  case key_type::u32:
+    return run_keyed<uint32_t>(argv[1], param, streams, threads, options,
+                               perf_spec, index.get(), cold);
+  case key_type::u64:
+    return run_keyed<uint64_t>(argv[1], param, streams, threads, options,
+                               perf_spec, index.get(), cold);
+  case key_type::u128:
+    return run_keyed<unsigned __int128>(argv[1], param, streams, threads,
+                                        options, perf_spec, index.get(), cold);
+  }
+
+  auto lookups = keys_path.empty() ? param.LookupSize : 0;
+  State s(param.SizeInBytes, lookups, param.Repeat, options,
+          index ? index->keys<int>() : std::span<int const>());
+  s.print();
+  if (!s.perf.open(perf_spec))
+    return usage("invalid perf counter\n\n");
+
+  if (!keys_path.empty())
+    return stream(s, argv[1], streams, keys_path, chunk);
+
+  if (algo->prepare)
+    algo->prepare(s);
 
-  s.start(streams, argv[1]);
+  if (param.ExpectedResult < 0 && s.expected >= 0)
+    param.ExpectedResult = s.expected * s.repeat;
+  if (param.ExpectedResult < 0 || algo->reference) {
+    auto reference = algo->reference ? algo->reference : &testNaive<int>;
+    s.start(1, 1, "reference");
+    param.ExpectedResult = reference(s) * s.repeat;
+  }
+  if (cold)
+    index->drop_cache();
+
+  s.start(streams, threads, argv[1]);
 
   long sum = 0;
   int repeat = s.repeat;
   while (repeat-- > 0) {
-    auto result = (*testFn)(s);
+    auto result = (*algo->fn)(s);
     sum += result;
   }
   s.stop();
+  s.report();
   printf("sum %ld\n", sum);
+  if (algo->report)
+    algo->report(s, sum);
+  if (algo->verify && !algo->verify(s))
+    return 1;
   if (sum != param.ExpectedResult) {
     printf("!!!! BUG, expected %ld\n", param.ExpectedResult);
     return 1;
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Parses a byte count with an optional K, M or G suffix (powers of 1024).
+// Returns 0 if the string is not a valid size.
+inline size_t parse_size(std::string_view str) {
+  std::string s(str);
+  char *end = nullptr;
+  auto value = strtoull(s.c_str(), &end, 10);
+  if (end == s.c_str())
+    return 0;
+
+  std::string_view suffix = end;
+  if (suffix == "K" || suffix == "k")
+    return value << 10;
+  if (suffix == "M" || suffix == "m")
+    return value << 20;
+  if (suffix == "G" || suffix == "g")
+    return value << 30;
+  return suffix.empty() ? value : 0;
+}
+
+// Splits a comma separated list.
+inline std::vector<std::string_view> split_list(std::string_view str) {
+  std::vector<std::string_view> result;
+  while (!str.empty()) {
+    auto comma = str.find(',');
+    result.push_back(str.substr(0, comma));
+    if (comma == str.npos)
+      break;
+    str.remove_prefix(comma + 1);
+  }
+  return result;
+}
+
+// Matches --name=value and stores the value.
+inline bool match_option(std::string_view opt, std::string_view name,
+                         std::string_view &value) {
+  if (!opt.starts_with("--"))
+    return false;
+  opt.remove_prefix(2);
+  if (!opt.starts_with(name) || opt.size() <= name.size() ||
+      opt[name.size()] != '=')
+    return false;
+  value = opt.substr(name.size() + 1);
+  return true;
+}
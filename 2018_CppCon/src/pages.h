@@ -0,0 +1,142 @@
+#pragma once
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// Page size backing the test data.
+//   system  plain anonymous mapping, whatever the kernel's THP policy gives
+//   small   4K pages, transparent huge pages disabled for the mapping
+//   thp     2M aligned mapping with madvise(MADV_HUGEPAGE)
+//   huge2m  explicit 2M hugetlbfs pages (needs vm.nr_hugepages)
+//   huge1g  explicit 1G hugetlbfs pages (needs a 1G pool, usually at boot)
+enum class page_mode { system, small, thp, huge2m, huge1g };
+
+inline char const *page_mode_name(page_mode mode) {
+  switch (mode) {
+  case page_mode::system: return "system";
+  case page_mode::small: return "4k";
+  case page_mode::thp: return "thp";
+  case page_mode::huge2m: return "2m";
+  case page_mode::huge1g: return "1g";
+  }
+  return "?";
+}
+
+inline bool parse_page_mode(std::string_view name, page_mode &mode) {
+  for (auto m : {page_mode::system, page_mode::small, page_mode::thp,
+                 page_mode::huge2m, page_mode::huge1g})
+    if (name == page_mode_name(m)) {
+      mode = m;
+      return true;
+    }
+  return false;
+}
+
+inline size_t page_mode_size(page_mode mode) {
+  switch (mode) {
+  case page_mode::thp:
+  case page_mode::huge2m: return size_t(2) << 20;
+  case page_mode::huge1g: return size_t(1) << 30;
+  default: return size_t(4) << 10;
+  }
+}
+
+// Rounded up to the page size, page_free must see the same length.
+inline size_t page_round(size_t bytes, page_mode mode) {
+  auto page = page_mode_size(mode);
+  return (bytes + page - 1) & ~(page - 1);
+}
+
+// Maps zero filled memory backed by the requested pages. If hugetlbfs pages
+// are not available it says so and falls back to transparent huge pages.
+inline void *page_alloc(size_t bytes, page_mode mode) {
+  auto len = page_round(bytes, mode);
+  auto prot = PROT_READ | PROT_WRITE;
+  auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if (mode == page_mode::huge2m || mode == page_mode::huge1g) {
+    auto huge = MAP_HUGETLB |
+                (mode == page_mode::huge2m ? MAP_HUGE_2MB : MAP_HUGE_1GB);
+    auto p = mmap(nullptr, len, prot, flags | huge, -1, 0);
+    if (p != MAP_FAILED)
+      return p;
+    fprintf(stderr, "pages: %s hugetlb mapping of %zu bytes failed (%s), "
+                    "falling back to thp\n",
+            page_mode_name(mode), len, strerror(errno));
+    mode = page_mode::thp;
+  }
+
+  if (mode == page_mode::thp) {
+    // Over-allocate so the mapping can be trimmed to 2M alignment.
+    auto align = page_mode_size(mode);
+    auto p = mmap(nullptr, len + align, prot, flags, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    auto base = reinterpret_cast<uintptr_t>(p);
+    auto aligned = (base + align - 1) & ~(align - 1);
+    if (aligned != base)
+      munmap(p, aligned - base);
+    if (auto tail = base + len + align - (aligned + len))
+      munmap(reinterpret_cast<void *>(aligned + len), tail);
+    if (madvise(reinterpret_cast<void *>(aligned), len, MADV_HUGEPAGE) != 0)
+      fprintf(stderr, "pages: madvise(MADV_HUGEPAGE) failed (%s)\n",
+              strerror(errno));
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  auto p = mmap(nullptr, len, prot, flags, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::bad_alloc();
+  if (mode == page_mode::small)
+    madvise(p, len, MADV_NOHUGEPAGE);
+  return p;
+}
+
+inline void page_free(void *p, size_t bytes, page_mode mode) {
+  munmap(p, page_round(bytes, mode));
+}
+
+// std allocator over page_alloc, for containers holding test data.
+template <typename T> struct page_allocator {
+  using value_type = T;
+
+  page_mode mode = page_mode::system;
+
+  page_allocator() = default;
+  explicit page_allocator(page_mode mode) : mode(mode) {}
+  template <typename U>
+  page_allocator(page_allocator<U> const &rhs) : mode(rhs.mode) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(page_alloc(n * sizeof(T), mode));
+  }
+  void deallocate(T *p, size_t n) { page_free(p, n * sizeof(T), mode); }
+
+  // Default-initializes, so resize() leaves the fresh pages untouched for
+  // whoever writes them first.
+  template <typename U> void construct(U *p) { ::new (static_cast<void *>(p)) U; }
+  template <typename U, typename... Args> void construct(U *p, Args &&...args) {
+    ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+  }
+
+  friend bool operator==(page_allocator const &a, page_allocator const &b) {
+    return a.mode == b.mode;
+  }
+};
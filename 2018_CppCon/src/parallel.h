@@ -0,0 +1,105 @@
+#pragma once
+#include <pthread.h>
+#include <algorithm>
+#include <sched.h>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Pins the calling thread to the n-th cpu from the process affinity mask.
+inline void pin_to_cpu(unsigned n) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+
+  unsigned count = CPU_COUNT(&allowed);
+  if (count == 0)
+    return;
+  n %= count;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed) || n-- != 0)
+      continue;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    return;
+  }
+}
+
+// Number of cpus in the process affinity mask.
+inline unsigned cpu_count() {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return 1;
+  return std::max(1, CPU_COUNT(&allowed));
+}
+
+// Runs fn(first, last) over parts of [0, count), one pinned thread per cpu,
+// so the pages a part writes first are placed on its cpu's node. Small
+// counts run on the calling thread.
+template <typename Fn> void parallel_fill(size_t count, Fn fn) {
+  unsigned threads = count < (1u << 20) ? 1 : cpu_count();
+  if (threads <= 1) {
+    fn(size_t(0), count);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    size_t first = count * i / threads;
+    size_t last = count * (i + 1) / threads;
+    workers.emplace_back([&fn, first, last, i] {
+      pin_to_cpu(i);
+      fn(first, last);
+    });
+  }
+  for (auto &w : workers)
+    w.join();
+}
+
+// Splits lookups into `threads` contiguous slices, runs fn(slice) or
+// fn(slice, worker index) on a pinned worker thread per slice and returns the
+// sum of the results. With a single thread, fn runs on the calling thread.
+template <typename Lookups, typename Fn>
+long parallel_lookup(Lookups const &all, int threads, Fn fn) {
+  using Slice = std::span<typename Lookups::value_type const>;
+  Slice lookups(all);
+  auto call = [&fn](Slice slice, int worker) -> long {
+    if constexpr (std::is_invocable_v<Fn &, Slice, int>)
+      return fn(slice, worker);
+    else
+      return fn(slice);
+  };
+
+  if (threads <= 1)
+    return call(lookups, 0);
+
+  std::vector<long> results(threads);
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+
+  size_t chunk = lookups.size() / threads;
+  size_t extra = lookups.size() % threads;
+  size_t offset = 0;
+
+  for (int i = 0; i < threads; ++i) {
+    size_t n = chunk + (size_t(i) < extra ? 1 : 0);
+    auto slice = lookups.subspan(offset, n);
+    offset += n;
+    workers.emplace_back([&call, &results, slice, i] {
+      pin_to_cpu(i);
+      results[i] = call(slice, i);
+    });
+  }
+
+  long sum = 0;
+  for (int i = 0; i < threads; ++i) {
+    workers[i].join();
+    sum += results[i];
+  }
+  return sum;
+}
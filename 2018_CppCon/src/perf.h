@@ -0,0 +1,232 @@
+#pragma once
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hardware performance counters read around the timed region of a test.
+//
+// The spec is a comma separated list of groups. A group is either one of the
+// predefined names below or counters joined by '+', e.g.
+//
+//   --perf=ipc,cache           two predefined groups
+//   --perf=cycles+dtlb-misses  one custom group
+//   --perf=cycles+r0c0c00a3    raw events are given as r<hex config>
+//
+// The kernel schedules the members of a group together, so ratios within a
+// group are exact. Separate groups may be multiplexed and are scaled by their
+// enabled/running time. Counters that cannot be opened (VMs, containers, a
+// different cpu vendor for raw events) are reported as n/a.
+constexpr uint64_t perf_cache_event(uint64_t cache, uint64_t op,
+                                    uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+struct perf_counters {
+  struct event_def {
+    char const *name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+  static constexpr event_def events[] = {
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"l1d-misses", PERF_TYPE_HW_CACHE,
+       perf_cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+      {"llc-misses", PERF_TYPE_HW_CACHE,
+       perf_cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+      {"dtlb-misses", PERF_TYPE_HW_CACHE,
+       perf_cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+      {"stalls-backend", PERF_TYPE_HARDWARE,
+       PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+      // Intel Skylake and later: CYCLE_ACTIVITY.CYCLES_L1D_MISS and
+      // CYCLE_ACTIVITY.STALLS_L1D_MISS, cycles with an outstanding L1D miss
+      // and cycles stalled while one is outstanding.
+      {"l1d-pending", PERF_TYPE_RAW, 0x080008a3},
+      {"l1d-stalls", PERF_TYPE_RAW, 0x0c0c00a3},
+  };
+
+  struct group_def {
+    char const *name;
+    char const *members;
+  };
+
+  static constexpr group_def groups[] = {
+      {"ipc", "cycles+instructions"},
+      {"cache", "l1d-misses+llc-misses"},
+      {"tlb", "dtlb-misses"},
+      {"stall", "cycles+l1d-pending+l1d-stalls+stalls-backend"},
+      {"default", "ipc,cache,tlb,stall"},
+  };
+
+  struct counter {
+    std::string name;
+    int fd = -1;
+    double value = 0;
+  };
+
+  struct group {
+    std::string name;
+    std::vector<counter> counters;
+    int leader = -1;
+  };
+
+  std::vector<group> active;
+
+  perf_counters() = default;
+  perf_counters(perf_counters const &) = delete;
+
+  ~perf_counters() {
+    for (auto &g : active)
+      for (auto &c : g.counters)
+        if (c.fd >= 0)
+          close(c.fd);
+  }
+
+  // Must be called before any worker threads are started, counters are
+  // inherited only by threads created after they are opened.
+  bool open(std::string_view spec) {
+    while (!spec.empty()) {
+      auto comma = spec.find(',');
+      auto item = spec.substr(0, comma);
+      spec = comma == spec.npos ? std::string_view{} : spec.substr(comma + 1);
+
+      if (auto def = find_group(item)) {
+        if (std::string_view(def->members).find(',') != std::string_view::npos) {
+          if (!open(def->members))
+            return false;
+          continue;
+        }
+        if (!open_group(item, def->members))
+          return false;
+      } else if (!open_group(item, item))
+        return false;
+    }
+    return true;
+  }
+
+  bool empty() const { return active.empty(); }
+
+  void start() {
+    for (auto &g : active)
+      for (auto &c : g.counters)
+        if (c.fd >= 0)
+          ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+    for (auto &g : active)
+      if (g.leader >= 0)
+        ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  void stop() {
+    for (auto &g : active)
+      if (g.leader >= 0)
+        ioctl(g.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (auto &g : active)
+      for (auto &c : g.counters) {
+        c.value = -1;
+        uint64_t buf[3]; // value, time enabled, time running
+        if (c.fd < 0 || read(c.fd, buf, sizeof(buf)) != sizeof(buf))
+          continue;
+        if (buf[2] == 0)
+          continue; // never scheduled
+        c.value = buf[2] < buf[1] ? buf[0] * (double(buf[1]) / buf[2]) : buf[0];
+      }
+  }
+
+  // Prints every group on its own line, counts divided by `ops`.
+  void print(double ops) const {
+    for (auto &g : active) {
+      printf("  %s:", g.name.c_str());
+      for (auto &c : g.counters)
+        if (c.value < 0)
+          printf(" %s n/a", c.name.c_str());
+        else
+          printf(" %s %.2f", c.name.c_str(), c.value / ops);
+      printf(" per lookup\n");
+    }
+  }
+
+private:
+  static group_def const *find_group(std::string_view name) {
+    for (auto &g : groups)
+      if (name == g.name)
+        return &g;
+    return nullptr;
+  }
+
+  static bool find_event(std::string_view name, uint32_t &type,
+                         uint64_t &config) {
+    for (auto &e : events)
+      if (name == e.name) {
+        type = e.type;
+        config = e.config;
+        return true;
+      }
+    if (name.size() > 1 && name[0] == 'r') {
+      std::string hex(name.substr(1));
+      char *end = nullptr;
+      config = strtoull(hex.c_str(), &end, 16);
+      type = PERF_TYPE_RAW;
+      return *end == '\0';
+    }
+    return false;
+  }
+
+  bool open_group(std::string_view name, std::string_view members) {
+    group g;
+    g.name = name;
+
+    while (!members.empty()) {
+      auto plus = members.find('+');
+      auto item = members.substr(0, plus);
+      members = plus == members.npos ? std::string_view{}
+                                     : members.substr(plus + 1);
+
+      uint32_t type;
+      uint64_t config;
+      if (!find_event(item, type, config)) {
+        fprintf(stderr, "perf: unknown counter '%.*s'\n", (int)item.size(),
+                item.data());
+        return false;
+      }
+
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = g.leader < 0;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      counter c;
+      c.name = item;
+      c.fd = syscall(SYS_perf_event_open, &attr, 0, -1, g.leader, 0);
+      if (c.fd < 0)
+        fprintf(stderr, "perf: %s unavailable (%s)\n", c.name.c_str(),
+                strerror(errno));
+      else if (g.leader < 0)
+        g.leader = c.fd;
+      g.counters.push_back(std::move(c));
+    }
+
+    active.push_back(std::move(g));
+    return true;
+  }
+};
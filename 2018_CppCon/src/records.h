@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "coro_infra.h"
+
+// Two-stage lookup: a binary search of the sorted index finds the key's
+// position, the position's slot names the record, and the record holds the
+// key and its value. Records are stored in shuffled order, so after the
+// index search the record fetch is another chain of two dependent misses.
+struct record_store {
+  struct record {
+    int key;
+    uint32_t value;
+  };
+
+  std::vector<uint32_t> slot; // index position -> record
+  std::vector<record> records;
+
+  explicit record_store(std::span<int const> keys)
+      : slot(keys.size()), records(keys.size()) {
+    for (uint32_t i = 0; i < slot.size(); ++i)
+      slot[i] = i;
+    std::shuffle(slot.begin(), slot.end(), std::mt19937_64(1));
+    for (size_t i = 0; i < keys.size(); ++i)
+      records[slot[i]] = {keys[i], (uint32_t)i};
+  }
+};
+
+// Position of val in v, or -1.
+inline ptrdiff_t naive_index_search(std::span<int const> v, int val) {
+  size_t first = 0;
+  size_t len = v.size();
+  while (len > 0) {
+    auto half = len / 2;
+    auto middle = first + half;
+    auto x = v[middle];
+    if (x == val)
+      return middle;
+    if (x < val) {
+      first = middle + 1;
+      len = len - half - 1;
+    } else
+      len = half;
+  }
+  return -1;
+}
+
+// True if val is in the index and its record agrees.
+inline bool naive_two_stage_lookup(std::span<int const> v,
+                                   record_store const &store, int val) {
+  auto pos = naive_index_search(v, val);
+  if (pos < 0)
+    return false;
+  return store.records[store.slot[pos]].key == val;
+}
+
+inline task<ptrdiff_t> CoroIndexSearch(std::span<int const> v, int val) {
+  size_t first = 0;
+  size_t len = v.size();
+  while (len > 0) {
+    auto half = len / 2;
+    auto middle = first + half;
+    auto x = co_await prefetch(v[middle]);
+    if (x == val)
+      co_return middle;
+    if (x < val) {
+      first = middle + 1;
+      len = len - half - 1;
+    } else
+      len = half;
+  }
+  co_return -1;
+}
+
+inline task<record_store::record const *>
+CoroFetchRecord(record_store const &store, size_t pos) {
+  auto slot = co_await prefetch(store.slot[pos]);
+  co_return &co_await prefetch(store.records[slot]);
+}
+
+template <typename Found, typename NotFound>
+root_task CoroTwoStageLookup(std::span<int const> v, record_store const &store,
+                             int val, Found on_found, NotFound on_not_found) {
+  auto pos = co_await CoroIndexSearch(v, val);
+  if (pos >= 0) {
+    auto rec = co_await CoroFetchRecord(store, pos);
+    if (rec->key == val)
+      co_return on_found(*rec);
+  }
+  on_not_found();
+}
+
+template <typename Streams>
+long CoroTwoStageMultiLookup(std::span<int const> v, record_store const &store,
+                             std::span<int const> lookups, Streams &&streams) {
+  return CoroSearchMultiLookup(lookups, streams, [&](int key, auto... cb) {
+    return CoroTwoStageLookup(v, store, key, cb...);
+  });
+}
@@ -1,31 +1,144 @@
 #pragma once
 
-#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
 
-template <typename T>
-struct rng {
-  std::mt19937_64 generator;
-  std::uniform_int_distribution<T> distribution;
-  int count;
+// SplitMix64 finaliser, every input bit reaches every output bit.
+inline uint64_t splitmix64_mix(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
 
-  rng(unsigned int seed, T from, T to, int count) : distribution(from, to), count(count) {
-    generator.seed(seed);
+// Counter-based generator: the i-th number of a stream is a hash of the
+// seed and i (the SplitMix64 finaliser), so any part of a stream can be
+// generated on its own and the numbers do not depend on how the stream is
+// split across threads, or on the standard library.
+struct counter_rng {
+  uint64_t seed;
+
+  uint64_t operator()(uint64_t i) const {
+    return splitmix64_mix(seed + (i + 1) * 0x9E3779B97F4A7C15ull);
+  }
+
+  // Uniform in [from, to] by multiply-shift, the bias is at most
+  // (to - from + 1) / 2^64.
+  uint64_t uniform(uint64_t i, uint64_t from, uint64_t to) const {
+    auto span = (unsigned __int128)(to - from) + 1;
+    return from + uint64_t(((*this)(i) * span) >> 64);
+  }
+
+  // Uniform in [0, 1) with 53 bits.
+  double unit(uint64_t i) const { return double((*this)(i) >> 11) * 0x1p-53; }
+};
+
+// Zipf distributed ranks in [0, n), rank 0 is the most frequent. Uses the
+// rejection-free method of Gray et al. ("Quickly generating billion-record
+// synthetic databases"), as in YCSB. Theta must be in [0, 1), 0 is uniform.
+struct zipf_distribution {
+  uint64_t n;
+  double theta, alpha, zetan, eta, half_pow_theta;
+
+  zipf_distribution(uint64_t n, double theta) : n(n), theta(theta) {
+    zetan = zeta(n, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) /
+          (1.0 - zeta(2, theta) / zetan);
+    half_pow_theta = 1.0 + std::pow(0.5, theta);
   }
 
-  struct iterator {
-    rng& owner;
-    int count;
+  // Sum of 1 / i^theta for i in [1, n]. The first zeta_head terms are added
+  // up, the rest is the integral of x^-theta over [zeta_head + 0.5, n + 0.5],
+  // whose relative error is below 1e-10 past the head.
+  static constexpr uint64_t zeta_head = 1 << 16;
 
-    bool operator != (iterator const& rhs) const {
-      return rhs.count != count;
-    }
+  static double zeta(uint64_t n, double theta) {
+    if (theta == 0)
+      return double(n);
+    double sum = 0;
+    auto head = std::min(n, zeta_head);
+    for (uint64_t i = 1; i <= head; ++i)
+      sum += 1.0 / std::pow((double)i, theta);
+    auto tail = [=](double x) { return std::pow(x + 0.5, 1.0 - theta); };
+    if (n > head)
+      sum += (tail(n) - tail(head)) / (1.0 - theta);
+    return sum;
+  }
 
-    iterator& operator++() { --count; return *this; }
+  // The rank for a uniform u in [0, 1).
+  uint64_t rank(double u) const {
+    double uz = u * zetan;
+    if (uz < 1.0)
+      return 0;
+    if (uz < half_pow_theta)
+      return 1;
+    auto rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+    return rank < n ? rank : n - 1;
+  }
+};
 
-    T operator* () { return owner.distribution(owner.generator); }
+// Ranks in [0, n) of the i-th lookup, stateless so lookups can be generated
+// in parallel like the rest of a counter_rng stream. n must not be 0.
+
+// Zipf ranks scattered over [0, n) by a multiplicative permutation, so the
+// hot keys are spread over the array rather than packed into its first lines.
+struct zipf_ranks {
+  counter_rng gen;
+  zipf_distribution zipf;
+  uint64_t step; // coprime to n, about 0.618 n
+
+  zipf_ranks(counter_rng gen, uint64_t n, double theta)
+      : gen(gen), zipf(n, theta), step(uint64_t(n * 0.6180339887) | 1) {
+    while (std::gcd(step, n) != 1)
+      step += 2;
+  }
+
+  uint64_t operator()(uint64_t i) const {
+    auto r = (unsigned __int128)zipf.rank(gen.unit(i)) * step;
+    return uint64_t(r % zipf.n);
+  }
+};
+
+// A share of the lookups uniform over a contiguous hot range of `hot` ranks in
+// the middle of [0, n), the rest uniform over all of it.
+struct hotspot_ranks {
+  counter_rng gen, coin;
+  uint64_t n, first, hot;
+  double share;
+
+  hotspot_ranks(counter_rng gen, counter_rng coin, uint64_t n, double keys,
+                double share)
+      : gen(gen), coin(coin), n(n),
+        hot(std::max<uint64_t>(1, std::min<uint64_t>(n, uint64_t(n * keys)))),
+        share(share) {
+    first = (n - hot) / 2;
+  }
+
+  uint64_t operator()(uint64_t i) const {
+    if (coin.unit(i) < share)
+      return first + gen.uniform(i, 0, hot - 1);
+    return gen.uniform(i, 0, n - 1);
+  }
+};
+
+// Runs of `run` consecutive ranks, each starting at a uniform rank and
+// wrapping around at n, like range scans or a sequential batch.
+struct run_ranks {
+  counter_rng gen;
+  uint64_t n, run;
+
+  uint64_t operator()(uint64_t i) const {
+    auto start = gen.uniform(i / run, 0, n - 1);
+    return (start + i % run) % n;
+  }
+};
 
-  };
+// Ranks uniform over [0, n).
+struct uniform_ranks {
+  counter_rng gen;
+  uint64_t n;
 
-  iterator begin() { return {*this, count}; }
-  iterator end() { return {*this, 0}; }
+  uint64_t operator()(uint64_t i) const { return gen.uniform(i, 0, n - 1); }
 };
@@ -0,0 +1,129 @@
+#pragma once
+#include <immintrin.h>
+#include <span>
+#include <stdint.h>
+
+// Batched branchless binary search, the hardware-parallel competitor to
+// interleaving. Every lane runs the same lower bound search:
+//
+//   base = 0, n = size
+//   while (n > 1) { half = n / 2; if (v[base + half] < x) base += half; n -= half; }
+//   lb = base + (v[base] < x), found if lb < size && v[lb] == x
+//
+// n does not depend on the key, so all lanes take the same number of steps
+// and a vector of 8 (AVX2) or 16 (AVX-512) searches advances with one gather
+// and one compare per level. Indices are 32 bit, v must have fewer than 2^31
+// elements.
+
+// Scalar fallback, eight searches at a time to give the core some ILP.
+inline long simd_lookup_scalar(std::span<int const> v,
+                               std::span<int const> lookups) {
+  constexpr int W = 8;
+  int const *a = v.data();
+  size_t size = v.size();
+  long found = 0;
+
+  size_t i = 0;
+  for (; i + W <= lookups.size(); i += W) {
+    size_t base[W] = {};
+    for (size_t n = size; n > 1; n -= n / 2)
+      for (int j = 0; j < W; ++j)
+        base[j] += a[base[j] + n / 2] < lookups[i + j] ? n / 2 : 0;
+    for (int j = 0; j < W; ++j) {
+      auto lb = base[j] + (a[base[j]] < lookups[i + j]);
+      found += lb < size && a[lb] == lookups[i + j];
+    }
+  }
+  for (; i < lookups.size(); ++i) {
+    size_t base = 0;
+    for (size_t n = size; n > 1; n -= n / 2)
+      base += a[base + n / 2] < lookups[i] ? n / 2 : 0;
+    auto lb = base + (a[base] < lookups[i]);
+    found += lb < size && a[lb] == lookups[i];
+  }
+  return found;
+}
+
+__attribute__((target("avx2"))) inline long
+simd_lookup_avx2(std::span<int const> v, std::span<int const> lookups) {
+  int const *a = v.data();
+  int size = (int)v.size();
+  long found = 0;
+
+  auto last = _mm256_set1_epi32(size - 1);
+  auto one = _mm256_set1_epi32(1);
+
+  size_t i = 0;
+  for (; i + 8 <= lookups.size(); i += 8) {
+    auto x = _mm256_loadu_si256((__m256i const *)&lookups[i]);
+    auto base = _mm256_setzero_si256();
+    for (int n = size; n > 1; n -= n / 2) {
+      auto half = _mm256_set1_epi32(n / 2);
+      auto mid = _mm256_add_epi32(base, half);
+      auto y = _mm256_i32gather_epi32(a, mid, 4);
+      auto less = _mm256_cmpgt_epi32(x, y);
+      base = _mm256_add_epi32(base, _mm256_and_si256(less, half));
+    }
+    auto y = _mm256_i32gather_epi32(a, base, 4);
+    auto lb = _mm256_sub_epi32(base, _mm256_cmpgt_epi32(x, y));
+    auto in_range = _mm256_cmpgt_epi32(_mm256_add_epi32(last, one), lb);
+    auto z = _mm256_i32gather_epi32(a, _mm256_min_epi32(lb, last), 4);
+    auto hit = _mm256_and_si256(in_range, _mm256_cmpeq_epi32(x, z));
+    found += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+  }
+  return found + simd_lookup_scalar(v, lookups.subspan(i));
+}
+
+__attribute__((target("avx512f"))) inline long
+simd_lookup_avx512(std::span<int const> v, std::span<int const> lookups) {
+  int const *a = v.data();
+  int size = (int)v.size();
+  long found = 0;
+
+  auto last = _mm512_set1_epi32(size - 1);
+
+  size_t i = 0;
+  for (; i + 16 <= lookups.size(); i += 16) {
+    auto x = _mm512_loadu_si512(&lookups[i]);
+    auto base = _mm512_setzero_si512();
+    for (int n = size; n > 1; n -= n / 2) {
+      auto half = _mm512_set1_epi32(n / 2);
+      auto y = _mm512_i32gather_epi32(_mm512_add_epi32(base, half), a, 4);
+      base = _mm512_mask_add_epi32(base, _mm512_cmpgt_epi32_mask(x, y), base,
+                                   half);
+    }
+    auto y = _mm512_i32gather_epi32(base, a, 4);
+    auto lb = _mm512_mask_add_epi32(base, _mm512_cmpgt_epi32_mask(x, y), base,
+                                    _mm512_set1_epi32(1));
+    auto in_range = _mm512_cmple_epi32_mask(lb, last);
+    auto z = _mm512_i32gather_epi32(_mm512_min_epi32(lb, last), a, 4);
+    found += __builtin_popcount(_mm512_mask_cmpeq_epi32_mask(in_range, x, z));
+  }
+  return found + simd_lookup_scalar(v, lookups.subspan(i));
+}
+
+using simd_lookup_fn = long (*)(std::span<int const>, std::span<int const>);
+
+// Picks the widest implementation the cpu supports.
+inline simd_lookup_fn simd_lookup_dispatch(char const **isa = nullptr) {
+  char const *name = "scalar";
+  simd_lookup_fn fn = &simd_lookup_scalar;
+  if (__builtin_cpu_supports("avx512f")) {
+    name = "avx512";
+    fn = &simd_lookup_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    name = "avx2";
+    fn = &simd_lookup_avx2;
+  }
+  if (isa)
+    *isa = name;
+  return fn;
+}
+
+inline long SimdMultiLookup(std::span<int const> v,
+                            std::span<int const> lookups) {
+  static simd_lookup_fn fn = simd_lookup_dispatch();
+  if (v.empty())
+    return 0;
+  return fn(v, lookups);
+}
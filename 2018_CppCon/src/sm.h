@@ -1,17 +1,20 @@
 #pragma once
+#include <array>
+#include <span>
+#include <utility>
 #include <vector>
 #include <xmmintrin.h>
 
 // Handcrafted state machine's frame.
-struct Frame {
+template <typename Key> struct BasicFrame {
   enum State { KEEP_GOING, FOUND, NOT_FOUND, EMPTY };
 
-  int const* first;
-  int const* last;
-  int const* middle;
+  Key const* first;
+  Key const* last;
+  Key const* middle;
   size_t len;
   size_t half;
-  int val;
+  Key val;
   State state = EMPTY;
 
   template <typename T>
@@ -19,7 +22,7 @@ struct Frame {
     _mm_prefetch(reinterpret_cast<const char*>(&x), _MM_HINT_NTA);
   }
 
-  void init(int const* first, int const* last, int key)
+  void init(Key const* first, Key const* last, Key key)
   {
     this->val = key;
     this->first = first;
@@ -64,6 +67,8 @@ struct Frame {
   }
 };
 
+using Frame = BasicFrame<int>;
+
 bool sm_binary_search(int const* first, int const* last, int key) {
   Frame f;
   f.init(first, last, key);
@@ -73,8 +78,10 @@ bool sm_binary_search(int const* first, int const* last, int key) {
 }
 
 // Multi lookup with prefetching using hand-crafted state machine.
+template <typename Key>
 long SmMultiLookup(
-  std::vector<int> const& v, std::vector<int> const& lookups, int streams) {
+  std::span<Key const> v, std::span<Key const> lookups, int streams) {
+  using Frame = BasicFrame<Key>;
   std::vector<Frame> f(streams);
   size_t N = streams - 1;
   size_t i = N;
@@ -117,3 +124,107 @@ long SmMultiLookup(
   return result;
 }
 
+
+// SmMultiLookup with the stream count S fixed at compile time. The frames
+// are kept as arrays of their fields, a frame is busy while its len is not
+// 0, and every round of the ring steps each frame once, unrolled. Until
+// fewer than S lookups are left every round refills without bounds checks.
+template <int S, typename Key>
+long SmStaticMultiLookup(std::span<Key const> v, std::span<Key const> lookups) {
+  Key const *first[S];
+  size_t len[S];
+  Key val[S];
+
+  auto beg = v.data();
+  auto size = v.size();
+  size_t next = 0;
+  long result = 0;
+
+  auto start = [&](int j) {
+    val[j] = lookups[next++];
+    first[j] = beg;
+    len[j] = size;
+    BasicFrame<Key>::prefetch(beg[size / 2]);
+  };
+
+  // Consumes frame j's prefetched middle, returns true when the search ended.
+  auto step = [&](int j) {
+    auto half = len[j] / 2;
+    auto x = first[j][half];
+    if (x == val[j]) {
+      ++result;
+      return true;
+    }
+    if (x < val[j]) {
+      first[j] += half + 1;
+      len[j] -= half + 1;
+    } else
+      len[j] = half;
+    if (len[j] == 0)
+      return true;
+    BasicFrame<Key>::prefetch(first[j][len[j] / 2]);
+    return false;
+  };
+
+  auto each = [](auto fn) {
+    [&]<int... J>(std::integer_sequence<int, J...>) {
+      (fn(J), ...);
+    }(std::make_integer_sequence<int, S>{});
+  };
+
+  if (size == 0)
+    return 0;
+
+  int busy = 0;
+  for (; busy < S && next < lookups.size(); ++busy)
+    start(busy);
+  for (int j = busy; j < S; ++j)
+    len[j] = 0;
+  if (busy < S) {
+    // Fewer lookups than frames, the idle frames keep len 0.
+    while (busy > 0)
+      for (int j = 0; j < S; ++j)
+        if (len[j] != 0 && step(j)) {
+          len[j] = 0;
+          --busy;
+        }
+    return result;
+  }
+
+  while (lookups.size() - next >= S)
+    each([&](int j) {
+      if (step(j))
+        start(j);
+    });
+
+  while (busy > 0)
+    each([&](int j) {
+      if (len[j] == 0 || !step(j))
+        return;
+      if (next < lookups.size())
+        start(j);
+      else {
+        len[j] = 0;
+        --busy;
+      }
+    });
+
+  return result;
+}
+
+using sm_static_fn = long (*)(std::span<int const>, std::span<int const>);
+
+// Precompiled stream counts of SmStaticMultiLookup.
+inline constexpr int sm_static_max = 32;
+
+// SmStaticMultiLookup<streams> for 1 <= streams <= sm_static_max, else null.
+inline sm_static_fn sm_static_dispatch(int streams) {
+  static constexpr auto table =
+      []<int... S>(std::integer_sequence<int, S...>) {
+        return std::array<sm_static_fn, sizeof...(S)>{
+            &SmStaticMultiLookup<S + 1, int>...};
+      }(std::make_integer_sequence<int, sm_static_max>{});
+  if (streams < 1 || streams > sm_static_max)
+    return nullptr;
+  return table[streams - 1];
+}
@@ -0,0 +1,340 @@
+#pragma once
+#include "hash.h"
+#include "join.h"
+#include "key_type.h"
+#include "learned.h"
+#include "parallel.h"
+#include "layout.h"
+#include "pages.h"
+#include "perf.h"
+#include "records.h"
+#include "rng.h"
+#include "string_keys.h"
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <math.h>
+#include <memory>
+#include <ratio>
+#include <span>
+#include <stdio.h>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Distribution of the generated array's keys.
+//   uniform  0, 2, 4, .. every key position is linear in the key
+//   skewed   2 * i plus a quartic term, half of the keys sit in the first
+//            sixth of the key range and the gaps widen towards the end
+enum class key_data { uniform, skewed };
+
+inline char const *key_data_name(key_data data) {
+  return data == key_data::skewed ? "skewed" : "uniform";
+}
+
+inline bool parse_key_data(std::string_view name, key_data &data) {
+  for (auto d : {key_data::uniform, key_data::skewed})
+    if (name == key_data_name(d)) {
+      data = d;
+      return true;
+    }
+  return false;
+}
+
+// Distribution of the generated lookups.
+//   uniform    uniform over [0, range]
+//   phased     the first half from the bottom 1/64 of the range, which stays
+//              in cache, the second half uniform, so static slices of the
+//              lookups take very different times
+// The others pick the rank of an array key (see the *_ranks of rng.h) and
+// look up the key itself or, to miss, the key plus one:
+//   zipf       zipf ranks with Options::theta, hot keys scattered
+//   hotspot    Options::hot_share of the lookups in a contiguous range of
+//              Options::hot_keys of the keys, the rest uniform
+//   sequential runs of Options::run consecutive keys from uniform starts
+// Options::hit_ratio sets the fraction of them found, and also makes uniform
+// pick ranks, so that its hit ratio can be set too.
+enum class lookup_dist { uniform, phased, zipf, hotspot, sequential };
+
+inline char const *lookup_dist_name(lookup_dist dist) {
+  switch (dist) {
+  case lookup_dist::uniform: return "uniform";
+  case lookup_dist::phased: return "phased";
+  case lookup_dist::zipf: return "zipf";
+  case lookup_dist::hotspot: return "hotspot";
+  case lookup_dist::sequential: return "sequential";
+  }
+  return "?";
+}
+
+inline bool parse_lookup_dist(std::string_view name, lookup_dist &dist) {
+  for (auto d : {lookup_dist::uniform, lookup_dist::phased, lookup_dist::zipf,
+                 lookup_dist::hotspot, lookup_dist::sequential})
+    if (name == lookup_dist_name(d)) {
+      dist = d;
+      return true;
+    }
+  return false;
+}
+
+// Workload options shared by single runs and sweeps.
+struct Options {
+  key_type key = key_type::i32;
+  key_data data = key_data::uniform;
+  lookup_dist dist = lookup_dist::uniform;
+  page_mode pages = page_mode::system;
+  double selectivity = 0.5; // fraction of join probes that have a match
+  double skew = 0;          // zipf theta of matching join probes, 0 is uniform
+  bool latency = false;     // per lookup latency of the throttled engines
+  bool frames = false;      // coroutine frame pool counters after the run
+  double hit_ratio = -1;    // fraction of ranked lookups found, -1: default
+  double theta = 0.99;      // zipf lookups
+  double hot_keys = 0.01;   // hotspot lookups, fraction of keys that are hot
+  double hot_share = 0.9;   // and of lookups that go to them
+  uint64_t run = 64;        // sequential lookups, keys per run
+
+  // Whether lookups are drawn as ranks of array keys rather than values.
+  bool ranked() const {
+    return dist == lookup_dist::zipf || dist == lookup_dist::hotspot ||
+           dist == lookup_dist::sequential ||
+           (dist == lookup_dist::uniform && hit_ratio >= 0);
+  }
+};
+
+// Test state. The array holds the even numbers 0, 2, .. as Key, so about
+// half of the lookups drawn from [0, 2 * count] are found. The number found
+// is counted as the lookups are generated, where that is known.
+template <typename Key> struct BasicState {
+  using Vector = std::vector<Key, page_allocator<Key>>;
+  // Generated keys and lookups are at most the largest Random.
+  using Random = std::conditional_t<(sizeof(Key) > 8), uint64_t, Key>;
+
+  Vector owned;            // the array, unless it is mapped from an index
+  std::span<Key const> v; // the array searched
+  Vector lookups;
+  int repeat;
+  Options opt;
+  long expected = -1; // lookups found per pass, -1 if unknown
+
+  int streams;
+  int threads;
+  char const *algo_name;
+
+  perf_counters perf;
+
+  // Built by an algorithm's prepare step, outside of the timed region.
+  std::unique_ptr<chained_hash_map<Key>> hash;
+  std::unique_ptr<eytzinger<Key>> eyt;
+  std::unique_ptr<stree<Key>> btree;
+  std::unique_ptr<string_keys> strings;
+  std::unique_ptr<record_store> records;
+  std::unique_ptr<rmi<Key>> rmi_model;
+
+  // Join probe relation (one probe per lookup) and per worker output.
+  std::vector<Key> join_probe;
+  std::vector<std::vector<join_tuple>> join_out;
+
+  // Per lookup results of multi-get algorithms.
+  std::vector<ptrdiff_t> positions;
+
+  // One per worker thread when <streams> is auto.
+  std::vector<stream_tuner> tuners;
+
+  // One per worker thread when opt.latency is set, cleared by start().
+  std::vector<latency_histogram> latency;
+
+  // Generates the array, or views `mapped` when it is not empty (an index
+  // file of the same keys, see index_file.h).
+  BasicState(size_t ByteCount, int LookupCount, int Repeat, Options Opt = {},
+             std::span<Key const> mapped = {})
+      : owned(page_allocator<Key>(Opt.pages)),
+        lookups(page_allocator<Key>(Opt.pages)), repeat(Repeat), opt(Opt) {
+    counter_rng gen{0};
+
+    // The array and the lookups are filled in parallel, each thread first
+    // touching the pages it fills. Every value is a function of its index,
+    // so they do not depend on the number of threads.
+    size_t count = mapped.empty() ? ByteCount / sizeof(Key) : mapped.size();
+    uint64_t range = count + count;
+    if (mapped.empty()) {
+      // Extra range for the quartic term of skewed keys, up to 6x.
+      auto room = double(std::numeric_limits<Random>::max()) - 2.0 * count - 2;
+      auto extra = opt.data == key_data::skewed
+                       ? std::max(0.0, std::min(6.0 * count, room))
+                       : 0.0;
+      owned.resize(count);
+      parallel_fill(count, [&](size_t first, size_t last) {
+        if (extra == 0)
+          for (size_t i = first; i < last; ++i)
+            owned[i] = Key(i) + Key(i);
+        else
+          for (size_t i = first; i < last; ++i) {
+            auto x = double(i) / count;
+            owned[i] = Key(i) + Key(i) + Key(uint64_t(extra * x * x * x * x));
+          }
+      });
+      v = owned;
+      if (extra > 0)
+        range = uint64_t(v.back()) + 2;
+    } else
+      v = mapped;
+
+    lookups.resize(LookupCount);
+    if (opt.ranked() && count > 0) {
+      ranked_lookups(count);
+      return;
+    }
+
+    // Only the generated uniform keys are known to be the even numbers.
+    bool known = mapped.empty() && opt.data == key_data::uniform;
+    std::atomic<long> found = 0;
+    size_t hot = opt.dist == lookup_dist::phased ? LookupCount / 2 : 0;
+    parallel_fill(LookupCount, [&](size_t first, size_t last) {
+      long n = 0;
+      for (size_t i = first; i < last; ++i) {
+        auto x = gen.uniform(i, 0, i < hot ? range / 64 : range);
+        lookups[i] = Key(x);
+        n += x % 2 == 0 && x / 2 < count;
+      }
+      found += n;
+    });
+    if (known)
+      expected = found;
+  }
+
+  // Lookups of the key at a rank from opt.dist, or of that key plus one to
+  // miss with probability 1 - hit ratio. Keys are at least two apart, unless
+  // mapped from a file, where the next key is checked.
+  void ranked_lookups(uint64_t n) {
+    counter_rng gen{0}, coin{1};
+    double hits = opt.hit_ratio >= 0 ? opt.hit_ratio : 0.5;
+    std::atomic<long> found = 0;
+    auto fill = [&](auto rank) {
+      parallel_fill(lookups.size(), [&](size_t first, size_t last) {
+        long count = 0;
+        for (size_t i = first; i < last; ++i) {
+          auto r = rank(i);
+          bool hit = coin.unit(i) < hits;
+          lookups[i] = hit ? v[r] : v[r] + Key(1);
+          count += hit || (r + 1 < n && v[r + 1] == lookups[i]);
+        }
+        found += count;
+      });
+    };
+    switch (opt.dist) {
+    case lookup_dist::zipf: fill(zipf_ranks(gen, n, opt.theta)); break;
+    case lookup_dist::hotspot:
+      fill(hotspot_ranks(gen, counter_rng{2}, n, opt.hot_keys, opt.hot_share));
+      break;
+    case lookup_dist::sequential: fill(run_ranks{gen, n, opt.run}); break;
+    default: fill(uniform_ranks{gen, n}); break;
+    }
+    expected = found;
+  }
+
+  void print() const {
+    printf("count: %zu lookups: %zu %s repeat %d pages %s key %s %s",
+           v.size(), lookups.size(), lookup_dist_name(opt.dist), repeat,
+           page_mode_name(opt.pages), key_type_name(opt.key),
+           key_data_name(opt.data));
+    if (expected >= 0 && !lookups.empty())
+      printf(" hits %.3f", double(expected) / lookups.size());
+    printf("\n");
+  }
+
+  using hrc_clock = std::chrono::high_resolution_clock;
+  hrc_clock::time_point start_time;
+  double elapsed_ns = 0;
+
+  void start(int streams, int threads, const char *algo_name) {
+    this->streams = streams;
+    this->threads = threads;
+    this->algo_name = algo_name;
+    if (opt.latency)
+      latency.assign(threads, latency_histogram{});
+    perf.start();
+    start_time = hrc_clock::now();
+  }
+
+  // Returns ns per lookup/log2(size) of the timed region.
+  double stop() {
+    auto stop_time = hrc_clock::now();
+    perf.stop();
+    std::chrono::duration<double, std::nano> elapsed = stop_time - start_time;
+    elapsed_ns = elapsed.count();
+    return per_op();
+  }
+
+  // Batches taken from other workers by the stealing engines, see steal.h.
+  size_t stolen = 0;
+
+  // Lookups read by a streaming run, see key_stream.h.
+  size_t streamed = 0;
+
+  // Workers' throttlers record into the returned histogram for as long as
+  // it is alive, if latency is measured.
+  latency_scope record_latency(int worker) {
+    return latency_scope(opt.latency ? &latency[worker] : nullptr);
+  }
+
+  latency_histogram merged_latency() const {
+    latency_histogram all;
+    for (auto &h : latency)
+      all.merge(h);
+    return all;
+  }
+
+  double lookup_count() const {
+    return streamed ? (double)streamed : (double)lookups.size() * repeat;
+  }
+
+  double per_op() const {
+    auto divby = log2((double)v.size());
+    return elapsed_ns / divby / lookup_count();
+  }
+
+  void report() const {
+    printf("%g ns per lookup/log2(size)\n", per_op());
+    perf.print(lookup_count());
+    if (opt.frames)
+      frame_pool::all_stats().print();
+    if (streams == 0 && !tuners.empty()) {
+      double last = 0, mean = 0;
+      for (auto &t : tuners) {
+        last += t.streams;
+        mean += t.mean_streams();
+      }
+      printf("auto streams: final %g mean %g\n", last / tuners.size(),
+             mean / tuners.size());
+    }
+    if (opt.latency) {
+      auto all = merged_latency();
+      if (all.total == 0)
+        printf("latency: not recorded, %s has no throttler\n", algo_name);
+      else {
+        auto ns = 1 / tsc_per_ns();
+        printf("latency: p50 %.0f p99 %.0f p99.9 %.0f cycles, "
+               "%.0f %.0f %.0f ns\n",
+               all.quantile(0.5), all.quantile(0.99), all.quantile(0.999),
+               all.quantile(0.5) * ns, all.quantile(0.99) * ns,
+               all.quantile(0.999) * ns);
+      }
+    }
+  }
+};
+
+using State = BasicState<int>;
+
+using TestFn = long (*)(State& s);
+
+struct Algo {
+  char const *name;
+  TestFn fn;
+  bool uses_streams = false;
+  void (*prepare)(State &s) = nullptr; // builds data the algorithm searches
+  bool adaptive = false;                // accepts auto as <streams>
+  bool (*verify)(State &s) = nullptr;   // checks per lookup results
+  TestFn reference = nullptr;           // computes the expected result
+  void (*report)(State &s, long sum) = nullptr; // extra metrics
+};
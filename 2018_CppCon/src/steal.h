@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include "coro_infra.h"
+
+// Work stealing over the not yet started lookups.
+//
+// Every worker starts with the slice of the lookups parallel_lookup would
+// give it and claims `batch` keys at a time from the front of its range with
+// a fetch_add. A worker whose range is used up claims from the others' ranges
+// the same way, so there is no lock and no owner/thief handshake: a claim
+// that lands past the end of a range is simply dropped. Claims happen only
+// when a worker has spawned its whole previous batch, the resume loop of its
+// throttler never looks at another worker.
+constexpr size_t steal_batch = 256;
+
+class work_stealer {
+  // Every range's cursor has a line of its own, the only one claims write.
+  // The ends never change after construction and each worker's count of
+  // stolen batches sits on its own line too.
+  struct alignas(64) cursor {
+    std::atomic<size_t> next;
+  };
+  struct alignas(64) tally {
+    size_t stolen = 0; // batches its owner took from others
+  };
+
+  std::unique_ptr<cursor[]> cursors;
+  std::unique_ptr<size_t[]> ends;
+  std::unique_ptr<tally[]> tallies;
+  int workers;
+  size_t batch;
+
+public:
+  work_stealer(size_t count, int workers, size_t batch)
+      : cursors(new cursor[workers]), ends(new size_t[workers]),
+        tallies(new tally[workers]), workers(workers), batch(batch) {
+    size_t chunk = count / workers;
+    size_t extra = count % workers;
+    size_t offset = 0;
+    for (int i = 0; i < workers; ++i) {
+      size_t n = chunk + (size_t(i) < extra ? 1 : 0);
+      cursors[i].next.store(offset, std::memory_order_relaxed);
+      ends[i] = offset + n;
+      offset += n;
+    }
+  }
+
+  // Next [first, last) for worker, empty once every range is used up.
+  std::pair<size_t, size_t> claim(int worker) {
+    for (int k = 0; k < workers; ++k) {
+      auto victim = (worker + k) % workers;
+      auto &next = cursors[victim].next;
+      auto end = ends[victim];
+      if (next.load(std::memory_order_relaxed) >= end)
+        continue;
+      auto first = next.fetch_add(batch, std::memory_order_relaxed);
+      if (first >= end)
+        continue;
+      if (k != 0)
+        ++tallies[worker].stolen;
+      return {first, std::min(first + batch, end)};
+    }
+    return {0, 0};
+  }
+
+  size_t stolen() const {
+    size_t sum = 0;
+    for (int i = 0; i < workers; ++i)
+      sum += tallies[i].stolen;
+    return sum;
+  }
+};
+
+// Multi lookup of the keys worker claims from stealer, through one throttler
+// that stays full across batches.
+template <typename Key, typename Search, typename Streams>
+long CoroStealMultiLookup(std::span<Key const> lookups, work_stealer &stealer,
+                          int worker, Streams &&streams, Search search) {
+  lookup_counts counts;
+  size_t claimed = 0;
+
+  throttler t(streams);
+
+  for (;;) {
+    auto [first, last] = stealer.claim(worker);
+    if (first == last)
+      break;
+    spawn_lookups(t, lookups.subspan(first, last - first), search, counts);
+    claimed += last - first;
+  }
+
+  t.run();
+
+  return counts.checked(claimed);
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+#include <xmmintrin.h>
+
+// Sorted array of string_view keys, two misses per comparison: the slot with
+// the pointer and length, then the characters it points at.
+//
+// The key for integer x is its digit count as a letter followed by the
+// digits ("c10", "e1234"), so string order matches the order of the
+// non-negative ints it is made from and every algorithm finds exactly the
+// keys the int search finds. Key characters are laid out in shuffled order,
+// so neighbouring slots do not share the lines holding their characters.
+
+// Writes the key for x to out (at least 11 chars), returns its length.
+inline size_t make_string_key(int x, char *out) {
+  auto end = std::to_chars(out + 1, out + 11, x).ptr;
+  out[0] = char('a' + (end - out - 1));
+  return end - out;
+}
+
+struct string_keys {
+  std::vector<char> chars;
+  std::vector<std::string_view> keys;
+  std::vector<char> lookup_chars;
+  std::vector<std::string_view> lookups;
+
+  string_keys(std::span<int const> v, std::span<int const> lookup_ints)
+      : keys(v.size()), lookups(lookup_ints.size()) {
+    std::vector<uint32_t> order(v.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(1));
+    fill(chars, keys, v, order);
+
+    // Lookup keys stay in lookup order, reading them is sequential.
+    order.resize(lookup_ints.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    fill(lookup_chars, lookups, lookup_ints, order);
+  }
+
+  // Writes the key of ints[order[j]] j-th into chars and points out at it.
+  static void fill(std::vector<char> &chars, std::vector<std::string_view> &out,
+                   std::span<int const> ints, std::span<uint32_t const> order) {
+    char buf[11];
+    size_t total = 0;
+    for (auto x : ints)
+      total += make_string_key(x, buf);
+    chars.resize(total);
+
+    size_t pos = 0;
+    for (auto i : order) {
+      auto len = make_string_key(ints[i], &chars[pos]);
+      out[i] = std::string_view(&chars[pos], len);
+      pos += len;
+    }
+  }
+};
+
+// Handcrafted state machine's frame, SLOT waits for the string_view, PAYLOAD
+// for its characters.
+struct StrFrame {
+  enum State { SLOT, PAYLOAD, FOUND, NOT_FOUND, EMPTY };
+
+  std::string_view const *first;
+  std::string_view const *middle;
+  size_t len;
+  size_t half;
+  std::string_view x;
+  std::string_view val;
+  State state = EMPTY;
+
+  static void prefetch(void const *p) {
+    _mm_prefetch(static_cast<char const *>(p), _MM_HINT_NTA);
+  }
+
+  bool busy() const { return state == SLOT || state == PAYLOAD; }
+
+  void init(std::span<std::string_view const> v, std::string_view key) {
+    val = key;
+    first = v.data();
+    len = v.size();
+    if (len == 0) {
+      state = NOT_FOUND;
+      return;
+    }
+    half = len / 2;
+    middle = first + half;
+    state = SLOT;
+    prefetch(middle);
+  }
+
+  // Consumes the prefetched slot or characters, returns true when done.
+  bool run() {
+    if (state == SLOT) {
+      x = *middle;
+      state = PAYLOAD;
+      prefetch(x.data());
+      return false;
+    }
+
+    bool less = x < val;
+    if (less) {
+      first = middle + 1;
+      len = len - half - 1;
+    } else
+      len = half;
+
+    if (!less && !(val < x)) {
+      state = FOUND;
+      return true;
+    }
+
+    if (len > 0) {
+      half = len / 2;
+      middle = first + half;
+      state = SLOT;
+      prefetch(middle);
+      return false;
+    }
+
+    state = NOT_FOUND;
+    return true;
+  }
+};
+
+// Multi lookup with prefetching using hand-crafted state machine.
+inline long SmStrMultiLookup(std::span<std::string_view const> v,
+                             std::span<std::string_view const> lookups,
+                             int streams) {
+  std::vector<StrFrame> f(streams);
+  size_t i = 0;
+  long result = 0;
+
+  for (auto key : lookups) {
+    for (;;) {
+      auto &fr = f[i];
+      if (++i == f.size())
+        i = 0;
+      if (!fr.busy()) {
+        fr.init(v, key);
+        break;
+      }
+      if (fr.run()) {
+        if (fr.state == StrFrame::FOUND)
+          ++result;
+        fr.init(v, key);
+        break;
+      }
+    }
+  }
+
+  bool moreWork = false;
+  do {
+    moreWork = false;
+    for (auto &fr : f)
+      if (fr.busy()) {
+        moreWork = true;
+        if (fr.run() && fr.state == StrFrame::FOUND)
+          ++result;
+      }
+  } while (moreWork);
+
+  return result;
+}
@@ -0,0 +1,210 @@
+#pragma once
+#include "options.h"
+#include "state.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Parameter sweep over algorithms, dataset sizes, stream and thread counts.
+//
+// Every point is run `warmup` times untimed and then `runs` times, each run
+// timing `repeat` passes over the lookups. The median, p10 and p90 of
+// ns per lookup/log2(size) are reported as csv or json. A csv baseline from an
+// earlier sweep can be given to flag points whose median got slower by more
+// than `tolerance` percent. Stream count 0 stands for auto. With
+// options.latency the p50, p99 and p99.9 lookup latency in cycles of the
+// timed runs are added.
+struct Sweep {
+  std::vector<Algo const *> algos;
+  std::vector<size_t> sizes;
+  std::vector<int> streams;
+  std::vector<int> threads;
+  int lookups = 1024 * 1024;
+  int repeat = 1;
+  int warmup = 2;
+  int runs = 11;
+  bool json = false;
+  double tolerance = 5;
+  Options options;
+
+  using Key = std::tuple<std::string, size_t, int, int>;
+  std::map<Key, double> baseline;
+
+  struct Point {
+    Algo const *algo;
+    size_t size;
+    int streams;
+    int threads;
+    double median, p10, p90;
+    latency_histogram latency; // of the timed runs, with options.latency
+  };
+
+  static double percentile(std::vector<double> const &sorted, double q) {
+    auto pos = q * (sorted.size() - 1);
+    auto lo = (size_t)pos;
+    auto hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+  }
+
+  // Reads the algo, size, streams, threads and median columns of a csv
+  // written by an earlier sweep.
+  bool load_baseline(char const *path) {
+    std::ifstream in(path);
+    if (!in) {
+      fprintf(stderr, "sweep: cannot open baseline %s\n", path);
+      return false;
+    }
+
+    std::string line;
+    std::getline(in, line);
+    auto header = split_list(line);
+    auto column = [&](std::string_view name) {
+      auto it = std::find(header.begin(), header.end(), name);
+      return it == header.end() ? -1 : int(it - header.begin());
+    };
+    int algo = column("algo"), size = column("size"),
+        streams = column("streams"), threads = column("threads"),
+        median = column("median");
+    if (algo < 0 || size < 0 || streams < 0 || threads < 0 || median < 0) {
+      fprintf(stderr, "sweep: %s is not a sweep csv\n", path);
+      return false;
+    }
+
+    while (std::getline(in, line)) {
+      auto cells = split_list(line);
+      if ((int)cells.size() < (int)header.size())
+        continue;
+      Key key{std::string(cells[algo]), parse_size(cells[size]),
+              atoi(std::string(cells[streams]).c_str()),
+              atoi(std::string(cells[threads]).c_str())};
+      baseline[key] = atof(std::string(cells[median]).c_str());
+    }
+    return true;
+  }
+
+  void print_header() const {
+    if (json) {
+      printf("[\n");
+      return;
+    }
+    printf("algo,size,streams,threads,median,p10,p90");
+    if (options.latency)
+      printf(",lat_p50,lat_p99,lat_p999");
+    if (!baseline.empty())
+      printf(",baseline,change,status");
+    printf("\n");
+  }
+
+  void print_footer() const {
+    if (json)
+      printf("\n]\n");
+  }
+
+  // Prints a point and returns true if it regressed against the baseline.
+  bool print(Point const &p, bool first) const {
+    auto it = baseline.find(Key{p.algo->name, p.size, p.streams, p.threads});
+    double base = it == baseline.end() ? 0 : it->second;
+    double change = base > 0 ? (p.median / base - 1) * 100 : 0;
+    char const *status =
+        base <= 0 ? "new" : change > tolerance ? "REGRESSION" : "ok";
+
+    if (json) {
+      printf("%s  {\"algo\": \"%s\", \"size\": %zu, \"streams\": %d, "
+             "\"threads\": %d, \"median\": %g, \"p10\": %g, \"p90\": %g",
+             first ? "" : ",\n", p.algo->name, p.size, p.streams, p.threads,
+             p.median, p.p10, p.p90);
+      if (options.latency)
+        printf(", \"lat_p50\": %g, \"lat_p99\": %g, \"lat_p999\": %g",
+               p.latency.quantile(0.5), p.latency.quantile(0.99),
+               p.latency.quantile(0.999));
+      if (!baseline.empty())
+        printf(", \"baseline\": %g, \"change\": %.2f, \"status\": \"%s\"", base,
+               change, status);
+      printf("}");
+    } else {
+      printf("%s,%zu,%d,%d,%g,%g,%g", p.algo->name, p.size, p.streams,
+             p.threads, p.median, p.p10, p.p90);
+      if (options.latency)
+        printf(",%g,%g,%g", p.latency.quantile(0.5), p.latency.quantile(0.99),
+               p.latency.quantile(0.999));
+      if (!baseline.empty())
+        printf(",%g,%.2f,%s", base, change, status);
+      printf("\n");
+    }
+    fflush(stdout);
+
+    if (base > 0 && change > tolerance) {
+      fprintf(stderr, "REGRESSION %s size %zu streams %d threads %d: "
+                      "%g -> %g (%+.1f%%)\n",
+              p.algo->name, p.size, p.streams, p.threads, base, p.median,
+              change);
+      return true;
+    }
+    return false;
+  }
+
+  // Returns 0 on success, 1 on a result mismatch, 2 if anything regressed.
+  int run(Algo const &reference) {
+    bool first = true;
+    bool regressed = false;
+    bool mismatch = false;
+
+    print_header();
+    for (auto size : sizes) {
+      State s(size, lookups, repeat, options);
+
+      s.start(1, 1, reference.name);
+      long naive_expected = reference.fn(s);
+
+      for (auto algo : algos) {
+        if (algo->prepare)
+          algo->prepare(s);
+        long expected = naive_expected;
+        if (algo->reference) {
+          s.start(1, 1, reference.name);
+          expected = algo->reference(s);
+        }
+        for (auto st : streams) {
+          if (!algo->uses_streams ? st != streams.front()
+                                  : st == 0 && !algo->adaptive)
+            continue;
+          s.tuners.clear();
+          for (auto th : threads) {
+            std::vector<double> samples;
+            latency_histogram latency;
+            for (int i = 0; i < warmup + runs; ++i) {
+              s.start(st, th, algo->name);
+              long sum = 0;
+              for (int r = 0; r < repeat; ++r)
+                sum += algo->fn(s);
+              auto perop = s.stop();
+              if (sum != expected * repeat ||
+                  (algo->verify && i == 0 && !algo->verify(s))) {
+                fprintf(stderr, "!!!! BUG, %s size %zu streams %d: got %ld "
+                                "expected %ld\n",
+                        algo->name, size, st, sum, expected * repeat);
+                mismatch = true;
+              }
+              if (i >= warmup) {
+                samples.push_back(perop);
+                latency.merge(s.merged_latency());
+              }
+            }
+            std::sort(samples.begin(), samples.end());
+            Point p{algo, size, algo->uses_streams ? st : 1, th,
+                    percentile(samples, 0.5), percentile(samples, 0.1),
+                    percentile(samples, 0.9), latency};
+            regressed |= print(p, first);
+            first = false;
+          }
+        }
+      }
+    }
+    print_footer();
+    return mismatch ? 1 : regressed ? 2 : 0;
+  }
+};